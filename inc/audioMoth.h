@@ -19,6 +19,8 @@
 #define AM_UNIQUE_ID_START_ADDRESS             0xFE081F0
 #define AM_UNIQUE_ID_SIZE_IN_BYTES             8
 
+#define AM_NUMBER_OF_AUXILIARY_FILES           3
+
 /* Switch and battery state enumerations */
 
 typedef enum {AM_SWITCH_CUSTOM, AM_SWITCH_DEFAULT, AM_SWITCH_USB, AM_SWITCH_NONE} AM_switchPosition_t;
@@ -154,6 +156,11 @@ bool AudioMoth_renameFile(char *originalFilename, char *newFilename);
 
 bool AudioMoth_closeFile();
 
+bool AudioMoth_openAuxiliaryFile(uint32_t index, char *filename);
+bool AudioMoth_appendAuxiliaryFile(uint32_t index, char *filename);
+bool AudioMoth_writeToAuxiliaryFile(uint32_t index, void *bytes, uint16_t bytesToWrite);
+bool AudioMoth_closeAuxiliaryFile(uint32_t index);
+
 /* Debugging */
 
 void AudioMoth_setupSWOForPrint(void);
@@ -0,0 +1,114 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        decimator.h
+ *
+ * Description:  This library includes a polyphase FIR decimator that
+ *               replaces the sum of consecutive samples used to reduce
+ *               the sampling rate.
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+#ifndef INC_DECIMATOR_H_
+#define INC_DECIMATOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Decimation used to reduce the sampling rate. DECIMATOR_BOXCAR sums
+ * sampleRateDivider consecutive samples, DECIMATOR_FIR filters them with a
+ * linear phase low pass before keeping one sample of each
+ * sampleRateDivider. Dividers without taps use the boxcar. */
+#define DECIMATOR_BOXCAR                    0
+#define DECIMATOR_FIR                       1
+
+#ifndef DECIMATOR_TYPE
+#define DECIMATOR_TYPE                      DECIMATOR_FIR
+#endif
+
+/* The low pass of each divider has DECIMATOR_TAPS_PER_PHASE *
+ * sampleRateDivider taps. Up to DECIMATOR_MAX_DIVIDER the filter keeps
+ * the last (DECIMATOR_TAPS_PER_PHASE - 1) * sampleRateDivider samples of
+ * the previous block in front of the block, so every DMA buffer needs
+ * DECIMATOR_HISTORY_LENGTH free samples before it. */
+#define DECIMATOR_TAPS_PER_PHASE            16
+#define DECIMATOR_MAX_DIVIDER               16
+#define DECIMATOR_HISTORY_LENGTH            ((DECIMATOR_TAPS_PER_PHASE - 1) * DECIMATOR_MAX_DIVIDER)
+
+/* Decimator state, clipped counts the output samples clamped to the 16
+ * bit range since the last reset */
+
+typedef struct {
+	const int16_t *taps;
+	uint32_t numberOfTaps;
+	uint32_t divider;
+	uint32_t shift;
+	uint32_t clipped;
+	int16_t history[DECIMATOR_HISTORY_LENGTH];
+} decimator_state_t;
+
+/**
+ * Reset the decimator.
+ *
+ * Set the samples kept from the previous block and the count of clipped
+ * samples to zero to be ready for the next signal.
+ *
+ * @param state Decimator state.
+ */
+void DECIMATOR_reset(decimator_state_t *state);
+
+/**
+ * Init the decimator.
+ *
+ * Select the taps of the divider and the shift that leaves the output
+ * with the same scale as the sum of sampleRateDivider samples shifted by
+ * bitsToShift.
+ *
+ * @param state Decimator state.
+ * @param divider Sample rate divider.
+ * @param bitsToShift Left shift applied to the sum of divider samples.
+ * @return False if there are no taps for the divider.
+ */
+bool DECIMATOR_init(decimator_state_t *state, uint32_t divider,
+		int8_t bitsToShift);
+
+/**
+ * Decimate a block of samples in place.
+ *
+ * The block must have DECIMATOR_HISTORY_LENGTH writable samples before it.
+ * The samples kept from the previous block are copied in front of the
+ * block and the n / divider output samples are written over them, so the
+ * output starts before the input and never overwrites a sample that is
+ * still needed.
+ *
+ * @param state Decimator state.
+ * @param buffer Input samples, n must be a multiple of the divider.
+ * @param n Number of samples in the block.
+ * @return Pointer to the output samples.
+ */
+int16_t* DECIMATOR_process_block(decimator_state_t *state, int16_t *buffer,
+		uint32_t n);
+
+/**
+ * Decimate a block of samples into another buffer.
+ *
+ * The samples kept from the previous block are copied in front of the
+ * block as in DECIMATOR_process_block, but the block itself is left
+ * unchanged, so several decimators can read the same block as long as
+ * the one that writes in place runs last.
+ *
+ * @param state Decimator state.
+ * @param buffer Input samples, n must be a multiple of the divider.
+ * @param n Number of samples in the block.
+ * @param dest Output samples, n / divider samples are written.
+ * @return Number of output samples.
+ */
+uint32_t DECIMATOR_copy_block(decimator_state_t *state, int16_t *buffer,
+		uint32_t n, int16_t *dest);
+
+#endif /* INC_DECIMATOR_H_ */
@@ -0,0 +1,156 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        octave.h
+ *
+ * Description:  This library includes functions to compute the octave
+ *               and third-octave band levels with a multirate filter
+ *               bank and save them to SD memory.
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+#ifndef INC_OCTAVE_H_
+#define INC_OCTAVE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spl.h"
+
+/* Bands per octave, 1 (octave bands) or 3 (third-octave bands). The centre
+ * frequencies are 1000 * 2^(k / OCTAVE_BANDS_PER_OCTAVE) Hz (base two, IEC
+ * 61260-1) from OCTAVE_MIN_FREQUENCY to OCTAVE_MAX_FREQUENCY. */
+#ifndef OCTAVE_BANDS_PER_OCTAVE
+#define OCTAVE_BANDS_PER_OCTAVE             3
+#endif
+
+#define OCTAVE_MIN_FREQUENCY                19.0f
+#define OCTAVE_MAX_FREQUENCY                20500.0f
+
+/* The bands of the top octave of every stage have their centres between
+ * OCTAVE_STAGE_TOP / 2 and OCTAVE_STAGE_TOP times the rate of the stage,
+ * so all the stages share the same coefficients. The bands above the
+ * first stage are filtered at the first stage rate with their own
+ * coefficients. */
+#define OCTAVE_STAGE_TOP                    0.21f
+
+/* Half-band low pass before each decimation by two, two paths of first
+ * order allpass sections that run at the output rate. It is flat within
+ * 1e-7 dB up to the top band of the next stage (0.118 times the input
+ * rate) and attenuates the frequencies that alias into it by 79 dB. */
+#define OCTAVE_DECIMATION_COEFFICIENTS      4
+
+/* Maximum rate of the first stage, higher rates are decimated to it */
+#define OCTAVE_MAX_STAGE_RATE               128000.0f
+
+#define OCTAVE_MAX_STAGES                   16
+#define OCTAVE_MAX_BANDS                    (11 * OCTAVE_BANDS_PER_OCTAVE)
+#define OCTAVE_BUFFER_LENGTH                256
+
+/* Band pass filter, two biquads with numerator (1, 0, -1) */
+
+typedef struct {
+	float a[2][2];
+	float gain;
+} octave_band_coefficients_t;
+
+/* Stage of the decimation cascade */
+
+typedef struct {
+	float x[OCTAVE_DECIMATION_COEFFICIENTS];
+	float y[OCTAVE_DECIMATION_COEFFICIENTS];
+	float held;
+	uint32_t phase;
+	uint32_t firstBand;
+	uint32_t numberOfBands;
+	uint64_t n;
+} octave_stage_t;
+
+/* Filter bank state */
+
+typedef struct {
+	/* Coefficients of the bands shared by the stages and of the bands
+	 * above the first stage */
+	octave_band_coefficients_t sharedBands[OCTAVE_BANDS_PER_OCTAVE];
+	octave_band_coefficients_t topBands[OCTAVE_BANDS_PER_OCTAVE];
+	/* Cascade of stages, the first ones only decimate to the first stage
+	 * rate */
+	octave_stage_t stages[OCTAVE_MAX_STAGES];
+	uint32_t numberOfDecimationStages;
+	uint32_t numberOfStages;
+	uint32_t numberOfTopBands;
+	/* Bands from the highest to the lowest, filter state and energy */
+	uint32_t numberOfBands;
+	float frequency[OCTAVE_MAX_BANDS];
+	float w[OCTAVE_MAX_BANDS][2][2];
+	double energy[OCTAVE_MAX_BANDS];
+	float level[OCTAVE_MAX_BANDS];
+	/* Input rate and work buffer */
+	float fs;
+	float buffer[OCTAVE_BUFFER_LENGTH];
+} octave_state_t;
+
+/**
+ * Reset the filter bank.
+ *
+ * Set the temporal variables and the band energies to zero to be ready
+ * for the next signal.
+ *
+ * @param state Filter bank state.
+ */
+void OCTAVE_reset_filter_bank(octave_state_t *state);
+
+/**
+ * Init the filter bank.
+ *
+ * Find the stages and the bands for the sampling rate and design the
+ * decimation and band pass filters.
+ *
+ * @param state Filter bank state.
+ * @param fs Sampling rate in Hz.
+ */
+void OCTAVE_init_filter_bank(octave_state_t *state, float fs);
+
+/**
+ * Process a block of samples.
+ *
+ * Filters the block through the decimation cascade and the band pass
+ * filters of each stage and accumulates the energy of each band.
+ *
+ * @param state Filter bank state.
+ * @param src Input samples.
+ * @param n Number of samples in the block.
+ */
+void OCTAVE_process_block(octave_state_t *state, const int16_t *src,
+		uint32_t n);
+
+/**
+ * Convert the band energies to dB.
+ *
+ * Divide the energy of each band by the number of samples of its stage,
+ * correct the response of the microphone compensation filter at the
+ * centre of the band and sum the calibration offset of the SPL pipeline.
+ *
+ * @param state Filter bank state.
+ * @param spl SPL pipeline state.
+ */
+void OCTAVE_to_dB(octave_state_t *state, spl_state_t *spl);
+
+/**
+ * Append a line in the band log file.
+ *
+ * Append a line with a timestamp, the centre frequency of the lowest band,
+ * the number of bands per octave and the band levels in dB from the
+ * lowest to the highest band.
+ *
+ * @param state Filter bank state.
+ * @param currentTime Time when the record process started.
+ */
+void OCTAVE_write_log(octave_state_t *state, uint32_t currentTime);
+
+#endif /* INC_OCTAVE_H_ */
@@ -0,0 +1,343 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        spectrum.h
+ *
+ * Description:  This library includes functions to estimate the power
+ *               spectral density of a recording with the Welch method
+ *               and save it to SD memory.
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+#ifndef INC_SPECTRUM_H_
+#define INC_SPECTRUM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Length of the frames, a power of two. The frames are windowed with a
+ * Hann window and overlap by half, unless that gives more than
+ * SPECTRUM_MAX_FRAME_RATE frames per second, in which case the frames are
+ * spaced so that the rate is kept. */
+#define SPECTRUM_LENGTH                     1024
+#define SPECTRUM_BINS                       (SPECTRUM_LENGTH / 2 + 1)
+#define SPECTRUM_MAX_FRAME_RATE             100
+
+/* The levels are stored as int16 in hundredths of dB relative to the
+ * square of the 16 bit full scale per Hz */
+#define SPECTRUM_FULL_SCALE                 32768.0f
+
+/* Long-term spectral average, written to a sidecar file during the
+ * recording. Each column is the mean density of the frames of
+ * SPECTRUM_LTSA_DURATION ms in SPECTRUM_LTSA_BANDS bands of equal width
+ * from DC to the Nyquist frequency, stored as uint8 in steps of
+ * SPECTRUM_LTSA_LEVEL_STEP dB from SPECTRUM_LTSA_MIN_LEVEL. */
+#define SPECTRUM_LTSA_DURATION              1000
+#define SPECTRUM_LTSA_BANDS                 64
+#define SPECTRUM_LTSA_BINS_PER_BAND         (SPECTRUM_LENGTH / 2 / SPECTRUM_LTSA_BANDS)
+#define SPECTRUM_LTSA_MIN_LEVEL             -150.0f
+#define SPECTRUM_LTSA_LEVEL_STEP            0.5f
+#define SPECTRUM_LTSA_BUFFER_LENGTH         16
+#define SPECTRUM_LTSA_FILE                  1
+
+/* Ecoacoustic indices of the recording, computed on the same frames.
+ * The Acoustic Complexity Index adds the complexity of the consecutive
+ * clusters of SPECTRUM_ACI_DURATION ms. The Normalised Difference
+ * Soundscape Index compares the anthrophony and biophony bands and the
+ * Bioacoustic Index is the area of the mean spectrum in dB above its
+ * minimum in the bioacoustic band, in dB kHz. The bands are limited by
+ * the Nyquist frequency. The indices add a square root and updates of
+ * four sums in the external SRAM to every bin of every frame, and 8 kB to
+ * the work memory, so they are built only with SPECTRUM_INDICES set to 1. */
+#ifndef SPECTRUM_INDICES
+#define SPECTRUM_INDICES                    0
+#endif
+
+#define SPECTRUM_INDEX_ACI                  0
+#define SPECTRUM_INDEX_NDSI                 1
+#define SPECTRUM_INDEX_BI                   2
+#define SPECTRUM_INDEX_HF                   3
+#define SPECTRUM_INDEX_HT                   4
+#define SPECTRUM_NUMBER_OF_INDICES          5
+
+#define SPECTRUM_ACI_DURATION               5000
+#define SPECTRUM_ANTHROPHONY_MIN_FREQUENCY  1000.0f
+#define SPECTRUM_ANTHROPHONY_MAX_FREQUENCY  2000.0f
+#define SPECTRUM_BIOPHONY_MIN_FREQUENCY     2000.0f
+#define SPECTRUM_BIOPHONY_MAX_FREQUENCY     11000.0f
+#define SPECTRUM_BI_MIN_FREQUENCY           2000.0f
+#define SPECTRUM_BI_MAX_FREQUENCY           8000.0f
+
+/* Tonal components (ISO 1996-2 annex C, with the criterion of ECMA-74).
+ * The detector has its own frames of SPECTRUM_TONE_LENGTH samples, taken
+ * from the samples of the SPL pipeline and halved in rate while it is
+ * above SPECTRUM_TONE_SAMPLE_RATE, so the bins are at most 11.7 Hz wide
+ * whatever the rate of the recording. The frames are averaged over
+ * periods of SPECTRUM_TONE_DURATION ms, and in each period a local
+ * maximum of the spectrum is a tone if its tone-to-noise ratio exceeds
+ * 8 dB above 1 kHz and 8 + 8.33 log10(1000 / f) dB below. The tone is the
+ * power of the main lobe of the window, SPECTRUM_TONE_LOBE_BINS bins on
+ * each side of the peak, above the noise, and the noise is the power of
+ * the rest of the critical band (100 Hz wide below 500 Hz and 20 % of the
+ * frequency above) spread over the whole band. Critical bands with fewer
+ * than SPECTRUM_TONE_MIN_NOISE_BINS bins outside the lobe are not
+ * analysed. The periods in which each bin is a tone are counted over the
+ * recording, and the SPECTRUM_MAX_TONES longest components are appended
+ * to the tone log. The frames need 54 kB more of the external SRAM, which
+ * shortens the buffers of the recording; set SPECTRUM_TONES to 0 to
+ * build without the detector. */
+#ifndef SPECTRUM_TONES
+#define SPECTRUM_TONES                      1
+#endif
+
+#define SPECTRUM_TONE_LENGTH                4096
+#define SPECTRUM_TONE_BINS                  (SPECTRUM_TONE_LENGTH / 2 + 1)
+#define SPECTRUM_TONE_SAMPLE_RATE           48000
+#define SPECTRUM_TONE_DURATION              1000
+#define SPECTRUM_TONE_MIN_FREQUENCY         89.1f
+#define SPECTRUM_TONE_MAX_FREQUENCY         11200.0f
+#define SPECTRUM_TONE_LOBE_BINS             2
+#define SPECTRUM_TONE_MIN_NOISE_BINS        3
+#define SPECTRUM_MAX_TONES                  8
+
+/* The twiddle factors and the FFT buffer are shared by the spectrum and
+ * the tone frames, and are sized for the longest */
+#if SPECTRUM_TONES
+#define SPECTRUM_TWIDDLE_LENGTH             SPECTRUM_TONE_LENGTH
+#else
+#define SPECTRUM_TWIDDLE_LENGTH             SPECTRUM_LENGTH
+#endif
+
+/* Work memory of the estimator, placed in the external SRAM */
+
+typedef struct {
+	float twiddle[SPECTRUM_TWIDDLE_LENGTH / 4 + 1][2];
+	float buffer[SPECTRUM_TWIDDLE_LENGTH];
+	int16_t frame[SPECTRUM_LENGTH];
+	int16_t level[SPECTRUM_BINS];
+	uint8_t column[SPECTRUM_LTSA_BUFFER_LENGTH][SPECTRUM_LTSA_BANDS];
+#if SPECTRUM_INDICES
+	/* Amplitude of each bin in the previous frame, sums of the absolute
+	 * differences and of the amplitudes in the current cluster and sum of
+	 * the amplitudes of the recording */
+	float previousAmplitude[SPECTRUM_BINS];
+	float differenceSum[SPECTRUM_BINS];
+	float amplitudeSum[SPECTRUM_BINS];
+	float amplitudeTotal[SPECTRUM_BINS];
+#endif
+#if SPECTRUM_TONES
+	/* Tone frames, one filled by the interrupt while the main loop reads
+	 * the other, the power of the current tone period and, for each bin,
+	 * the periods in which it was a tone and the largest tone-to-noise
+	 * ratio. The cumulative power of a period is kept in the buffer. */
+	int16_t toneFrame[2][SPECTRUM_TONE_LENGTH];
+	float tonePower[SPECTRUM_TONE_BINS];
+	uint16_t tonePeriods[SPECTRUM_TONE_BINS];
+	float toneRatio[SPECTRUM_TONE_BINS];
+#endif
+} spectrum_scratch_t;
+
+#define SPECTRUM_SCRATCH_SIZE_IN_BYTES      sizeof(spectrum_scratch_t)
+
+/* Estimator state */
+
+typedef struct {
+	spectrum_scratch_t *scratch;
+	float fs;
+	float windowPower;
+	uint32_t hop;
+	uint32_t fill;
+	uint32_t skip;
+	uint32_t numberOfFrames;
+	/* Sums of the power of each bin and of each band of the current
+	 * column. They are updated for every bin of every frame, so they are
+	 * kept with the state in the internal RAM rather than in the work
+	 * memory. */
+	float power[SPECTRUM_BINS];
+	float powerCompensation[SPECTRUM_BINS];
+	float band[SPECTRUM_LTSA_BANDS];
+	/* Columns of the long-term spectral average, buffered until the main
+	 * loop writes them after the block that completed them */
+	uint32_t framesPerColumn;
+	uint32_t framesInColumn;
+	uint32_t columnWriteIndex;
+	uint32_t columnReadIndex;
+	/* Acoustic complexity of the completed clusters, power of the current
+	 * frame and sums of the frame amplitudes for the temporal entropy */
+	uint32_t framesPerCluster;
+	uint32_t framesInCluster;
+	float complexity;
+	float framePower;
+	double envelopeSum;
+	double envelopeEntropySum;
+	float indices[SPECTRUM_NUMBER_OF_INDICES];
+	/* Tone frames, counted by the interrupt when completed and by the
+	 * main loop when read, frames overwritten because the main loop had
+	 * not read the previous one, and the completed tone periods */
+	float toneFs;
+	uint32_t toneFill;
+	volatile uint32_t toneFramesWritten;
+	volatile uint32_t toneFramesRead;
+	uint32_t toneFramesDropped;
+	uint32_t framesPerTonePeriod;
+	uint32_t framesInTonePeriod;
+	uint32_t numberOfTonePeriods;
+} spectrum_state_t;
+
+/**
+ * Reset the estimator.
+ *
+ * Set the accumulated spectrum and the samples of the current frame to
+ * zero to be ready for the next signal.
+ *
+ * @param state Estimator state.
+ */
+void SPECTRUM_reset(spectrum_state_t *state);
+
+/**
+ * Init the estimator.
+ *
+ * Compute the twiddle factors of the FFT in the work memory and find the
+ * distance between frames for the sampling rate.
+ *
+ * @param state Estimator state.
+ * @param scratch Work memory, SPECTRUM_SCRATCH_SIZE_IN_BYTES bytes.
+ * @param fs Sampling rate in Hz.
+ * @param toneFs Sampling rate of the tone samples in Hz.
+ */
+void SPECTRUM_init(spectrum_state_t *state, spectrum_scratch_t *scratch,
+		float fs, float toneFs);
+
+/**
+ * Process a block of samples.
+ *
+ * Copies the samples to the current frame and, for each completed frame,
+ * accumulates the squared magnitude of the FFT of the windowed frame and
+ * adds it to the current column of the long-term spectral average.
+ * Called from the main loop with the samples already stored in the SRAM.
+ *
+ * @param state Estimator state.
+ * @param src Input samples.
+ * @param n Number of samples in the block.
+ */
+void SPECTRUM_process_block(spectrum_state_t *state, const int16_t *src,
+		uint32_t n);
+
+/**
+ * Add samples to the tone frames.
+ *
+ * Copies the samples to the tone frame being filled. A completed frame is
+ * handed to the main loop, or overwritten by the next one if the main
+ * loop has not read the previous frame yet. Called from the DMA interrupt
+ * with the samples of the SPL pipeline.
+ *
+ * @param state Estimator state.
+ * @param src Input samples at the rate of the tone samples.
+ * @param n Number of samples in the block.
+ */
+void SPECTRUM_add_tone_samples(spectrum_state_t *state, const int16_t *src,
+		uint32_t n);
+
+/**
+ * Process the completed tone frame.
+ *
+ * Adds the squared magnitude of the FFT of the windowed frame, without
+ * its mean, to the current tone period and finds the tones of each
+ * completed period. Called from the main loop.
+ *
+ * @param state Estimator state.
+ */
+void SPECTRUM_process_tones(spectrum_state_t *state);
+
+/**
+ * Compute the ecoacoustic indices.
+ *
+ * Compute the indices of the recording (ACI, NDSI, BI, spectral entropy
+ * Hf and temporal entropy Ht) from the sums of the frames. The temporal
+ * entropy uses the amplitude of each frame as envelope. Does nothing
+ * unless built with SPECTRUM_INDICES.
+ *
+ * @param state Estimator state.
+ */
+void SPECTRUM_to_indices(spectrum_state_t *state);
+
+/**
+ * Append the tonal components to the tone log file.
+ *
+ * Join the adjacent bins that were tones into components and append a
+ * line with the start time of the recording, the duration of the
+ * analysed periods in seconds and the number of tone frames dropped,
+ * followed by the frequency in Hz, the largest tone-to-noise ratio in dB
+ * and the duration in seconds of up to SPECTRUM_MAX_TONES components,
+ * from the longest. The samples of an incomplete last period are not
+ * used.
+ *
+ * @param state Estimator state.
+ * @param currentTime Time when the record process started.
+ * @return False if the file could not be written.
+ */
+bool SPECTRUM_write_tones(spectrum_state_t *state, uint32_t currentTime);
+
+/**
+ * Save the spectrum to a file.
+ *
+ * Write a 24 byte header (the characters SPLS, the start time of the
+ * recording, the sampling rate in Hz, the frame length, the number of
+ * frames and the number of bins, as little-endian uint32) followed by the
+ * one-sided power spectral density of each bin from DC to the Nyquist
+ * frequency, as int16 in hundredths of dB.
+ *
+ * @param state Estimator state.
+ * @param filename Name of the file.
+ * @param currentTime Time when the record process started.
+ * @return False if the file could not be written.
+ */
+bool SPECTRUM_write_file(spectrum_state_t *state, char *filename,
+		uint32_t currentTime);
+
+/**
+ * Open the long-term spectral average file.
+ *
+ * Write a 28 byte header (the characters SPLT, the start time of the
+ * recording, the sampling rate in Hz, the distance between frames in
+ * samples, the frames of each column and the number of bands, as
+ * little-endian uint32, and the level of the value 0 and the level step
+ * in hundredths of dB, as int16 and uint16). Each column is written
+ * afterwards as SPECTRUM_LTSA_BANDS uint8 from the lowest band.
+ *
+ * @param state Estimator state.
+ * @param filename Name of the file.
+ * @param currentTime Time when the record process started.
+ * @return False if the file could not be opened or written.
+ */
+bool SPECTRUM_open_ltsa_file(spectrum_state_t *state, char *filename,
+		uint32_t currentTime);
+
+/**
+ * Write the completed columns.
+ *
+ * Append the columns of the long-term spectral average completed since
+ * the last call to the file.
+ *
+ * @param state Estimator state.
+ * @return False if the file could not be written.
+ */
+bool SPECTRUM_write_ltsa(spectrum_state_t *state);
+
+/**
+ * Close the long-term spectral average file.
+ *
+ * Write the remaining completed columns and close the file. The samples
+ * of an incomplete last column are not written.
+ *
+ * @param state Estimator state.
+ * @return False if the file could not be written or closed.
+ */
+bool SPECTRUM_close_ltsa_file(spectrum_state_t *state);
+
+#endif /* INC_SPECTRUM_H_ */
@@ -18,12 +18,15 @@
 #define INC_SPL_H_
 
 #include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
 
 /* dBa filter constants */
 #define GA                                  1.2589254117941673f
+#define GC                                  1.0071635501321348f
 #define PI                                  3.141592653589793238462f
 #define CALdBA_low                          78.7f
 #define CALdBA_low_med                      74.5f
@@ -32,6 +35,429 @@
 #define CALdBA_high                         62.0f
 #define LOG_BUFFER_LENGTH                   50
 
+/* Frequency weightings computed in the same pass */
+#define SPL_WEIGHTING_A                     0
+#define SPL_WEIGHTING_C                     1
+#define SPL_WEIGHTING_Z                     2
+#define SPL_NUMBER_OF_WEIGHTINGS            3
+
+/* Cutoff of the high pass that removes the offset and the infrasound from
+ * the Z-weighting, in Hz */
+#define SPL_Z_WEIGHTING_CUTOFF              2.0f
+
+/* Minimum sampling rate of the SPL pipeline, in Hz. The samples of the
+ * microphone are decimated by the largest power of two up to
+ * DECIMATOR_MAX_DIVIDER that keeps this rate, independently of the
+ * sample rate divider of the recording. Set to 0 to run the pipeline at
+ * the rate of the recording. */
+#ifndef SPL_ANALYSIS_SAMPLE_RATE
+#define SPL_ANALYSIS_SAMPLE_RATE            48000
+#endif
+
+/* Input normalisation of the int16 samples */
+#define SPL_INPUT_NORMALIZATION             3276.8f
+
+/* Exponential time weighting (IEC 61672), time constants in seconds. The
+ * detectors are updated SPL_DETECTOR_RATE times per second with the mean
+ * square of the samples since the last update. They start at the mean
+ * square of the first SPL_DETECTOR_SETTLING_TIME, after which the max and
+ * min levels are tracked. At the rates that are not
+ * a multiple of SPL_DETECTOR_RATE (62.5 kHz) some periods take one sample
+ * more, so that the periods keep the detector rate on average. */
+#define SPL_TAU_FAST                        0.125f
+#define SPL_TAU_SLOW                        1.0f
+#define SPL_TAU_IMPULSE_RISE                0.035f
+#define SPL_TAU_IMPULSE_DECAY               1.5f
+#define SPL_DETECTOR_RATE                   1000
+#define SPL_DETECTOR_SETTLING_TIME          0.25f
+
+/* Short interval Leq time series, written to a sidecar file during the
+ * recording. The interval duration is in milliseconds, from 125 ms to
+ * 60 s, and the levels are stored as int16 in hundredths of dB. */
+#define SPL_INTERVAL_DURATION               1000
+#define SPL_INTERVAL_BUFFER_LENGTH          64
+#define SPL_INTERVAL_FILE                   0
+
+/* Noise events of the Fast A-weighted level. An event starts when the
+ * level exceeds SPL_EVENT_THRESHOLD dB and is kept if it lasts at least
+ * SPL_EVENT_MIN_DURATION ms, and it ends when the level falls
+ * SPL_EVENT_HYSTERESIS dB below the threshold. The events are appended to
+ * a file of the day. */
+#define SPL_EVENT_THRESHOLD                 70.0f
+#define SPL_EVENT_HYSTERESIS                3.0f
+#define SPL_EVENT_MIN_DURATION              1000
+#define SPL_EVENT_BUFFER_LENGTH             16
+#define SPL_EVENT_FILE                      2
+
+/* Day, evening and night levels of the recordings of each local day. The
+ * energy of each recording is split between the periods that it overlaps,
+ * day from SPL_DAY_START, evening from SPL_EVENING_START and night from
+ * SPL_NIGHT_START (Lden), with the night of Ldn from SPL_LDN_NIGHT_START.
+ * Times in seconds from local midnight. */
+#define SPL_DAY_START                       (7 * 3600)
+#define SPL_EVENING_START                   (19 * 3600)
+#define SPL_LDN_NIGHT_START                 (22 * 3600)
+#define SPL_NIGHT_START                     (23 * 3600)
+#define SPL_SECONDS_IN_DAY                  (24 * 3600)
+
+#define SPL_ROLLUP_DAY                      0
+#define SPL_ROLLUP_EVENING                  1
+#define SPL_ROLLUP_LATE_EVENING             2
+#define SPL_ROLLUP_NIGHT                    3
+#define SPL_NUMBER_OF_ROLLUP_PERIODS        4
+
+/* Statistics of the samples, counted in the sample loop of the recording.
+ * A recorded sample, after the DC filter, is saturated when it is clamped
+ * to the 16 bit range, near full scale when it is saturated or its
+ * magnitude is at least SPL_NEAR_FULL_SCALE (-1 dBFS) and under range
+ * when its magnitude is at most SPL_NOISE_FLOOR, one step of the 12 bit
+ * ADC at the 16 bit scale. A sample of the pipeline is clipped when it is
+ * clamped to the 16 bit range before the levels are computed. */
+#define SPL_NEAR_FULL_SCALE                 29204
+#define SPL_NOISE_FLOOR                     16
+
+/* Automatic gain ranging, enabled at build time with -DSPL_AUTO_GAIN=1.
+ * After each recording the gain is stepped down if the peak of the
+ * recorded samples reached SPL_AUTO_GAIN_MAX_PEAK or a sample was
+ * clamped, and stepped up if L90 is below SPL_AUTO_GAIN_MIN_L90 and the
+ * peak stays below SPL_AUTO_GAIN_MAX_PEAK at the higher gain. Levels are
+ * in dB relative to the 16 bit full scale. */
+#ifndef SPL_AUTO_GAIN
+#define SPL_AUTO_GAIN                       0
+#endif
+
+#define SPL_AUTO_GAIN_MAX_PEAK              -1.0f
+#define SPL_AUTO_GAIN_MIN_L90               -60.0f
+#define SPL_NUMBER_OF_GAINS                 5
+
+/* Calibration with a 1 kHz acoustic calibrator, enabled at build time
+ * with -DSPL_CALIBRATION=1. Each recording is made at the next gain
+ * setting. The tone is detected with a Goertzel filter over segments of
+ * SPL_CALIBRATION_SEGMENT_DURATION ms, and if it has at least
+ * SPL_CALIBRATION_MIN_PURITY of the power of the recording and no sample
+ * reached SPL_NEAR_FULL_SCALE, the offset of the gain is set so that the
+ * LAeq is the nearest calibrator level, if it is within
+ * SPL_CALIBRATION_MAX_ERROR dB of it. The offsets are saved in a file of
+ * the device and read before each recording in any build. The gains
+ * where the calibrator clips take the CALdBA constants moved by the mean
+ * correction of the measured gains. */
+#ifndef SPL_CALIBRATION
+#define SPL_CALIBRATION                     0
+#endif
+
+#define SPL_CALIBRATION_FREQUENCY           1000.0f
+#define SPL_CALIBRATION_LOW_LEVEL           94.0f
+#define SPL_CALIBRATION_HIGH_LEVEL          114.0f
+#define SPL_CALIBRATION_SEGMENT_DURATION    10
+#define SPL_CALIBRATION_MIN_PURITY          0.9f
+#define SPL_CALIBRATION_MAX_ERROR           6.0f
+#define SPL_CALIBRATION_FILE_LENGTH         64
+
+/* Occupational noise exposure of the recordings of each shift, from
+ * SPL_SHIFT_START seconds after local midnight to the same time of the
+ * next day. LEX,8h normalises the energy of the shift to
+ * SPL_DOSE_REFERENCE_DURATION. The dose is 100 % for the reference
+ * duration at SPL_DOSE_CRITERION_LEVEL and doubles every
+ * SPL_DOSE_EXCHANGE_RATE dB (3 dB for ISO 9612 and NIOSH, 5 dB for OSHA).
+ * It is computed on the levels of the intervals of the histogram. */
+#define SPL_SHIFT_START                     0
+#define SPL_DOSE_REFERENCE_DURATION         (8 * 3600)
+#define SPL_DOSE_CRITERION_LEVEL            85.0f
+#define SPL_DOSE_EXCHANGE_RATE              3.0f
+
+/* Histogram of the short interval levels for the statistical levels L10,
+ * L50, L90 and L95. The levels of consecutive intervals of
+ * SPL_HISTOGRAM_INTERVAL_DURATION ms are counted in 0.1 dB bins from
+ * SPL_HISTOGRAM_MIN_LEVEL, and the levels outside the range are counted
+ * in the first or the last bin. */
+#define SPL_HISTOGRAM_INTERVAL_DURATION     125
+#define SPL_HISTOGRAM_MIN_LEVEL             20.0f
+#define SPL_HISTOGRAM_BIN_WIDTH             0.1f
+#define SPL_HISTOGRAM_LENGTH                1000
+
+/* Optional true peak of the input samples of the pipeline, oversampled by
+ * SPL_TRUE_PEAK_OVERSAMPLING with a polyphase interpolation filter of
+ * SPL_TRUE_PEAK_TAPS taps per phase (ITU-R BS.1770). The input is not
+ * filtered, so its offset is part of the peak. Enabled at build time with
+ * -DSPL_TRUE_PEAK=1. */
+#ifndef SPL_TRUE_PEAK
+#define SPL_TRUE_PEAK                       0
+#endif
+
+#define SPL_TRUE_PEAK_OVERSAMPLING          4
+#define SPL_TRUE_PEAK_TAPS                  12
+#define SPL_TRUE_PEAK_FULL_SCALE            32768.0f
+
+/* Filter engine, selected at build time with -DSPL_ENGINE=... The float
+ * engines run the zeros of each section before its poles, so the offset
+ * of the microphone is removed before the recursions, and write the poles
+ * as their distance to z = 1, which keeps their precision close to the
+ * unit circle at high sampling rates. The delta engine also feeds back
+ * the round-off of each recursion, which keeps the noise floor of the
+ * double precision filters in quiet environments at 192-384 kHz for about
+ * twice the cost of SPL_ENGINE_FLOAT. */
+#define SPL_ENGINE_FLOAT                    0
+#define SPL_ENGINE_Q31                      1
+#define SPL_ENGINE_FLOAT_DELTA              2
+
+#ifndef SPL_ENGINE
+#define SPL_ENGINE                          SPL_ENGINE_FLOAT_DELTA
+#endif
+
+/* LCeq and LZeq are computed in the same pass as LAeq. The C-weighting
+ * is the first and the last sections of the A-weighting, so it adds only
+ * its sum of squares, and the Z-weighting adds one high pass. Either can be
+ * left out at build time with -DSPL_LCEQ=0 or -DSPL_LZEQ=0, which the
+ * benchmark uses for their marginal cost; its level then reads -inf. */
+#ifndef SPL_LCEQ
+#define SPL_LCEQ                            1
+#endif
+
+#ifndef SPL_LZEQ
+#define SPL_LZEQ                            1
+#endif
+
+/* Poles of the delta engine: two of the compensation filter, the
+ * Z-weighting, the two double poles of the C-weighting and the two poles
+ * of the A-weighting */
+#define SPL_DELTA_POLES                     9
+
+/* Fixed point engine constants. Coefficients are Q30 so that the feedback
+ * terms of the second order sections (|a| < 2) fit in 32 bits. Samples are
+ * shifted left by SPL_Q31_INPUT_SHIFT. The compensation filter has a gain
+ * of (53.6 / 7.64)^2 = 34 dB at DC, so a full scale offset reaches 2^28 at
+ * its output, and the sum of the absolute values of the impulse response
+ * of each later section (2.3 for the double zero at DC, 1 for the high
+ * frequency section and 2 for each first order high pass) keeps every
+ * intermediate signal below 2^31 for any input. The block sums of the
+ * squares are flushed to double when they reach 2^SPL_Q31_SUM_LIMIT_BITS. */
+#define SPL_Q31_COEFFICIENT_SHIFT           30
+#define SPL_Q31_INPUT_SHIFT                 7
+#define SPL_Q31_SUM_LIMIT_BITS              62
+
+/* Energy (mean square relative to the reference pressure times seconds)
+ * and duration in seconds of the recordings of a local day in each
+ * period. It is kept in the backup domain between recordings, so it only
+ * has 32 bit fields. */
+
+typedef struct {
+	uint32_t day;
+	float energy[SPL_NUMBER_OF_ROLLUP_PERIODS];
+	float duration[SPL_NUMBER_OF_ROLLUP_PERIODS];
+} spl_rollup_t;
+
+/* Energy (mean square relative to the reference pressure times seconds),
+ * duration in seconds and dose in percent of the recordings of a shift,
+ * kept in the backup domain between recordings */
+
+typedef struct {
+	uint32_t shift;
+	float energy;
+	float duration;
+	float dose;
+} spl_exposure_t;
+
+/* Noise event record, as written to the event file */
+
+#pragma pack(push, 1)
+
+typedef struct {
+	uint32_t time;
+	uint32_t offset;
+	uint32_t duration;
+	int16_t LAmax;
+	int16_t SEL;
+} spl_event_t;
+
+#pragma pack(pop)
+
+/* Work memory of the pipeline, placed in the external SRAM. It holds the
+ * buffers that are written once per interval or per event and read after
+ * the recording, so the samples do not touch it. */
+
+typedef struct {
+	int16_t intervalBuffer[SPL_INTERVAL_BUFFER_LENGTH];
+	spl_event_t eventBuffer[SPL_EVENT_BUFFER_LENGTH];
+	uint32_t histogram[SPL_HISTOGRAM_LENGTH];
+} spl_scratch_t;
+
+#define SPL_SCRATCH_SIZE_IN_BYTES           sizeof(spl_scratch_t)
+
+/* SPL pipeline state */
+
+typedef struct {
+	spl_scratch_t *scratch;
+	/* Compensation filter coefficients */
+	float a_comp;
+	float b_comp;
+	float G_comp;
+	/* A-weighting filter coefficients */
+	float b4[2];
+	float G_A;
+	float G_C;
+	/* Z-weighting gain */
+	float G_Z;
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	/* Fixed point coefficients (Q30) and state */
+	int32_t q_a_comp;
+	int32_t q_b_comp;
+	int32_t q_b1;
+	int32_t q_a1[2];
+	int32_t q_b2;
+	int32_t q_a2;
+	int32_t q_b3;
+	int32_t q_a3;
+	int32_t q_b4[3];
+	int32_t q_a4[2];
+	int32_t q_x1;
+	int32_t q_c1;
+	int32_t q_rc;
+	int32_t q_rd;
+	int32_t q_d[2];
+	int32_t q_e[2];
+	int32_t q_f[2];
+	int32_t q_g1;
+	int32_t q_y1;
+	int32_t q_rg;
+	int32_t q_ry;
+	int32_t q_r[2];
+	int32_t q_b_Z;
+	int32_t q_a_Z;
+	int32_t q_z1;
+	int32_t q_rz;
+	float G_A_q31;
+	float G_C_q31;
+#endif
+#if SPL_ENGINE != SPL_ENGINE_Q31
+	/* Distances of the zeros and poles to z = 1 and state. Each pole keeps
+	 * its output and, in the delta engine, the round-off of its last
+	 * update. */
+	float d_beta_comp;
+	float d_alpha_comp;
+	float d_delta[4];
+	float d_delta_Z;
+	float d_y[SPL_DELTA_POLES];
+	float d_e[SPL_DELTA_POLES];
+	float d_x1;
+	float d_w2;
+#endif
+	/* Scaling of the squared outputs, including the input normalisation */
+	float energyScale[SPL_NUMBER_OF_WEIGHTINGS];
+	/* Sums of the squared A, C and Z-weighted signals (Kahan compensated),
+	 * number of samples and SPL values */
+	double energy[SPL_NUMBER_OF_WEIGHTINGS];
+	double energyCompensation[SPL_NUMBER_OF_WEIGHTINGS];
+	uint64_t n;
+	float spl;
+	float LCeq;
+	float LZeq;
+	/* Fast, Slow and Impulse detectors of the squared A-weighted signal.
+	 * The periods are detectorPeriod samples, plus one when the phase
+	 * passes SPL_DETECTOR_RATE. */
+	uint32_t sampleRate;
+	uint32_t detectorPeriod;
+	uint32_t detectorRemainder;
+	uint32_t detectorPhase;
+	uint32_t detectorLength;
+	uint32_t detectorCountdown;
+	uint32_t detectorSettling;
+	uint32_t detectorSettlingPeriods;
+	float detectorSum;
+	float alphaFast;
+	float alphaSlow;
+	float alphaImpulseRise;
+	float alphaImpulseDecay;
+	float fast;
+	float slow;
+	float impulse;
+	float fastMax;
+	float fastMin;
+	float slowMax;
+	float impulseMax;
+	/* Peak of the squared C-weighted signal */
+	float peakC;
+#if SPL_TRUE_PEAK
+	/* Polyphase filter, last input samples and true peak */
+	float truePeakTaps[SPL_TRUE_PEAK_OVERSAMPLING - 1][SPL_TRUE_PEAK_TAPS];
+	float truePeakHistory[SPL_TRUE_PEAK_TAPS];
+	float truePeak;
+#endif
+#if SPL_CALIBRATION
+	/* Goertzel filter at the calibrator frequency, sums of the current
+	 * segment and power of the tone and of the signal without its mean */
+	float goertzelCoefficient;
+	uint32_t goertzelLength;
+	uint32_t goertzelCount;
+	float goertzelS1;
+	float goertzelS2;
+	float goertzelSum;
+	float goertzelSumSquares;
+	float toneEnergy;
+	float signalEnergy;
+#endif
+	/* Short interval Leq, buffered until the main loop writes them */
+	uint32_t intervalPeriods;
+	uint32_t intervalCountdown;
+	uint32_t intervalSamples;
+	float intervalSum;
+	volatile uint32_t intervalWriteIndex;
+	volatile uint32_t intervalReadIndex;
+	uint32_t intervalsDropped;
+	/* Noise event detector on the Fast level, thresholds in mean square
+	 * units, periods and samples of the completed detector periods, current
+	 * event and completed events buffered until the main loop writes them */
+	float eventStart;
+	float eventEnd;
+	uint32_t eventMinPeriods;
+	uint32_t eventTime;
+	uint32_t detectorPeriods;
+	uint64_t detectorSamples;
+	bool eventActive;
+	uint32_t eventStartPeriod;
+	uint64_t eventStartSample;
+	double eventEnergy;
+	float eventMax;
+	volatile uint32_t eventWriteIndex;
+	volatile uint32_t eventReadIndex;
+	uint32_t eventsDropped;
+	/* Statistics of the samples, the recorded samples counted, largest
+	 * magnitude of the recorded samples, full scale if one was clamped,
+	 * and length of the current and the longest run of saturated recorded
+	 * samples */
+	uint32_t samplesCounted;
+	uint32_t samplesSaturated;
+	uint32_t samplesNearFullScale;
+	uint32_t samplesUnderRange;
+	uint32_t samplesClipped;
+	uint32_t samplePeak;
+	uint32_t overloadBurst;
+	uint32_t longestOverloadBurst;
+	/* Histogram of the short interval levels */
+	uint32_t histogramPeriods;
+	uint32_t histogramCountdown;
+	uint32_t histogramSamples;
+	float histogramSum;
+	uint32_t histogramCount;
+	/* Sum of the dose factors of the intervals of the histogram times
+	 * their durations in seconds */
+	float doseSum;
+	/* Time weighted levels in dB */
+	float LAFmax;
+	float LAFmin;
+	float LASmax;
+	float LAImax;
+	/* Statistical levels in dB */
+	float L10;
+	float L50;
+	float L90;
+	float L95;
+	/* Peak levels in dB, LCpeak and the true peak relative to full scale */
+	float LCpeak;
+	float dBTP;
+	/* Offset of the SPL measure (found in calibration) */
+	float cal_offset;
+} spl_state_t;
+
 /* Mic compensation filter */
 
 /**
@@ -41,101 +467,308 @@
  * for the next signal. Has to be called when the program starts and
  * when the filtering is finished.
  *
+ * @param state SPL pipeline state.
  */
-void SPL_reset_compensation_filter();
+void SPL_reset_compensation_filter(spl_state_t *state);
 
 /**
  * Init compensation filter.
  *
- * Initialize the coefficients of the compensation filter in function of
- * the sampling rate.
+ * Design the coefficients of the compensation filter for the sampling
+ * rate, any rate is supported.
  *
+ * @param state SPL pipeline state.
  * @param fs Sampling rate in Hz.
  */
-void SPL_init_compensation_filter(float fs);
+void SPL_init_compensation_filter(spl_state_t *state, float fs);
+
+/* dBA filter */
 
 /**
- * Step of the compensation filter.
+ * Reset dbA filter.
  *
- * Calculates the filter output given the input in a specific time, n.
- * After calculation, update the temp filter variables.
+ * Set temporal variables of the dbA filter and the SPL value to zero to
+ * be ready for the next signal. Has to be called when the program starts
+ * and when the filtering is finished.
  *
- * @param sample Sample of the input signal, x[n].
- * @return The output of the filter in time n, y[n].
+ * @param state SPL pipeline state.
  */
-float SPL_compensation_mic_filter_step(float sample);
+void SPL_reset_A_weighting_filter(spl_state_t *state);
 
-/* dBA filter */
+/**
+ * Init dBa filter.
+ *
+ * Initialize the coefficients of the dBa filter and the constants of the
+ * Fast, Slow and Impulse detectors in function of the sampling rate.
+ *
+ * @param state SPL pipeline state.
+ * @param scratch Work memory of the pipeline, which must stay valid
+ * while the state is used.
+ * @param fs Sampling rate in Hz.
+ */
+void SPL_init_A_weighting_filter(spl_state_t *state, spl_scratch_t *scratch,
+		float fs);
 
 /**
- * Reset dbA filter.
+ * Find the calibration offset.
  *
- * Set temporal variables of the dbA filter to zero to be ready for
- * the next signal. Has to be called when the program starts and when the
- * filtering is finished.
+ * The last step of the SPL estimation, is to sum an offset found in the
+ * calibration process. This function set this offset in function of the
+ * gain configured in the AudioMoth.
  *
+ * @param state SPL pipeline state.
+ * @param gain Gain configured in AudioMoth (0,1,2,3,4).
  */
-void SPL_reset_A_weighting_filter();
+void SPL_find_calibration_offset(spl_state_t *state, int gain);
 
 /**
- * Init dBa filter.
+ * Find the gain of the next recording.
  *
- * Initialize the coefficients of the dBa filter in function of the
- * sampling rate.
+ * Compare the peak of the recorded samples and the L90 level of the last
+ * recording, relative to the full scale at its gain, with the limits of
+ * the automatic gain ranging and step the gain down, up or keep it. The
+ * levels must have been converted to dB.
  *
- * @param fs Sampling rate in Hz.
+ * @param state SPL pipeline state.
+ * @param gain Gain of the last recording (0,1,2,3,4).
+ * @return Gain of the next recording.
  */
-void SPL_init_A_weighting_filter(float fs);
+uint32_t SPL_find_next_gain(spl_state_t *state, uint32_t gain);
 
 /**
- * Step of the dBa filter.
+ * Read the calibration file.
  *
- * Calculates the filter output given the input in a specific time, n.
- * After calculation, update the temp filter variables.
+ * Read the offsets measured with the calibrator from a text file with a
+ * line for each calibrated gain, with the gain and the offset in
+ * hundredths of dB. The gains that are not in the file take their
+ * default offset moved by the mean correction of the gains in the file.
+ * Must be called before the calibration offset is found.
  *
- * @param sample Sample of the input signal, x[n].
- * @return The output of the filter in time n, y[n].
+ * @param filename Name of the file.
+ * @return False if the file could not be read.
  */
-float SPL_A_weighting_filter_step(float sample);
+bool SPL_read_calibration(char *filename);
 
 /**
- * Find the calibration offset.
+ * Calibrate the gain with the recording.
  *
- * The last step of the SPL estimation, is to sum an offset found in the
- * calibration process. This function set this offset in function of the
- * gain configured in the AudioMoth.
+ * If the calibrator tone dominates the recording and was not clipped,
+ * set the offset of the gain so that the LAeq is the nearest calibrator
+ * level and update the offsets of the gains that were not measured. The
+ * levels must have been converted to dB. Only available with
+ * SPL_CALIBRATION.
  *
- * @param gain Gain configured in AudioMoth (0,1,2,3,4).
+ * @param state SPL pipeline state.
+ * @param gain Gain of the recording (0,1,2,3,4).
+ * @return True if the calibrator was detected and the offset was set.
  */
-void SPL_find_calibration_offset(int gain);
+bool SPL_calibrate(spl_state_t *state, uint32_t gain);
 
+/**
+ * Save the calibration file.
+ *
+ * Write the offsets of the calibrated gains in the format read by
+ * SPL_read_calibration.
+ *
+ * @param filename Name of the file.
+ * @return False if the file could not be written.
+ */
+bool SPL_write_calibration(char *filename);
+
+/**
+ * Process a block of samples.
+ *
+ * Runs the input scaling, the compensation filter, the A and C-weighting
+ * filters and the accumulation of the squared A, C and Z-weighted signals
+ * and of the C-weighted peak over a block of samples in a single pass.
+ * The C-weighting is the output of the first and the last (high
+ * frequency) sections of the A-weighting cascade, which the two remaining
+ * sections then turn into the A-weighting. The Z-weighting is the
+ * compensated signal after the SPL_Z_WEIGHTING_CUTOFF (2 Hz) high pass.
+ * The filter state is kept in local variables during the block and
+ * written back to the state at the end. The arithmetic depends on
+ * SPL_ENGINE.
+ *
+ * @param state SPL pipeline state.
+ * @param src Input samples.
+ * @param n Number of samples in the block.
+ */
+void SPL_process_block(spl_state_t *state, const int16_t *src, uint32_t n);
+
+/* Short interval Leq */
 
 /**
- * Update spl value.
+ * Open the interval file.
  *
- * Updates the mean of the sequence x^2[n], where x[n] is the output
- * signal of A-weighting filter.
+ * Create the sidecar file of the short interval Leq values and write its
+ * header, with the sampling rate of the pipeline.
  *
- * @param value x[n].
+ * @param state SPL pipeline state.
+ * @param filename Name of the sidecar file.
+ * @param currentTime Time when the record process started.
+ * @return True if the file was created.
+ */
+bool SPL_open_interval_file(spl_state_t *state, char *filename,
+		uint32_t currentTime);
+
+/**
+ * Write the buffered intervals.
+ *
+ * Append the short interval Leq values completed since the last call to
+ * the sidecar file. Called from the main loop, not from the interrupt.
+ *
+ * @param state SPL pipeline state.
+ * @return True if the values were written.
  */
-void SPL_update_value(float value);
+bool SPL_write_intervals(spl_state_t *state);
+
+/**
+ * Close the interval file.
+ *
+ * Write the remaining intervals and close the sidecar file.
+ *
+ * @param state SPL pipeline state.
+ * @return True if the file was closed.
+ */
+bool SPL_close_interval_file(spl_state_t *state);
 
 /**
  * Convert SPL value to dB
  *
- * Convert the SPL value to dB and sum the calibration offset.
+ * Divide the accumulated energies by the number of samples, convert them
+ * to dB and sum the calibration offset. Also converts the max and min levels
+ * of the time weighting detectors, the peak levels and finds the
+ * statistical levels in the histogram.
  *
+ * @param state SPL pipeline state.
  */
-void SPL_to_dB();
+void SPL_to_dB(spl_state_t *state);
 
 /**
  * Append a line in the LogFile.
  *
- * Append a line in the LogFile with a timestamp and the SPL value in dB.
+ * Append a line in the LogFile with a timestamp, the SPL value, the
+ * LAFmax, LASmax, LAImax and LAFmin levels, the L10, L50, L90 and L95
+ * levels, the LCeq and LZeq values and LCpeak in dB, followed by the true
+ * peak in dBTP when it is enabled, the values computed by other modules
+ * for the same recording and the statistics of the samples: the
+ * percentage of saturated samples of the pipeline, of near full scale and
+ * under range recorded samples and the longest overload burst in samples
+ * of the pipeline.
  *
+ * @param state SPL pipeline state.
  * @param currentTime Time when the record process started.
- * @param value SPL value
+ * @param values Values appended at the end of the line.
+ * @param numberOfValues Number of values appended.
+ */
+void SPL_write_log(spl_state_t *state, uint32_t currentTime,
+		const float *values, uint32_t numberOfValues);
+
+/**
+ * Open the noise event file.
+ *
+ * Find the thresholds of the event detector for the calibration offset
+ * and open the event file of the day to append the events of the
+ * recording. Each event is a 16 byte record with the start time of the
+ * recording, the start of the event from the start of the recording and
+ * its duration in milliseconds, as little-endian uint32, and the LAFmax
+ * and SEL of the event in hundredths of dB, as int16.
+ *
+ * @param state SPL pipeline state.
+ * @param filename Name of the file of the day.
+ * @param currentTime Time when the record process started.
+ * @return False if the file could not be opened.
+ */
+bool SPL_open_event_file(spl_state_t *state, char *filename,
+		uint32_t currentTime);
+
+/**
+ * Write the completed events.
+ *
+ * Append the events completed since the last call to the file.
+ *
+ * @param state SPL pipeline state.
+ * @return False if the file could not be written.
+ */
+bool SPL_write_events(spl_state_t *state);
+
+/**
+ * Close the noise event file.
+ *
+ * End the current event at the end of the recording, write the remaining
+ * events and close the file. The microphone must be disabled first, so that
+ * the interrupt no longer updates the event.
+ *
+ * @param state SPL pipeline state.
+ * @return False if the file could not be written or closed.
+ */
+bool SPL_close_event_file(spl_state_t *state);
+
+/**
+ * Reset the day levels.
+ *
+ * Set the energies and durations of the periods to zero for a new day.
+ *
+ * @param rollup Energies of the day.
+ * @param day Local day, days since 1 January 1970.
+ */
+void SPL_reset_rollup(spl_rollup_t *rollup, uint32_t day);
+
+/**
+ * Add a recording to the day levels.
+ *
+ * Add the LAeq of the recording to the periods that it overlaps. When the
+ * recording starts or ends on a later day than the stored one, a line
+ * with the date, Lden, Ldn, the day, evening and night levels and the
+ * hours measured in each period is appended to the day log file and the
+ * energies start again. The levels of a period without recordings are
+ * written as 0, and so is Lden or Ldn if one of its periods is missing.
+ *
+ * @param state SPL pipeline state, after SPL_to_dB.
+ * @param rollup Energies of the day.
+ * @param localTime Local time when the record process started.
+ * @param duration Duration of the recording in seconds.
+ */
+void SPL_update_rollup(spl_state_t *state, spl_rollup_t *rollup,
+		uint32_t localTime, uint32_t duration);
+
+/**
+ * Reset the exposure.
+ *
+ * Set the energy, duration and dose of the shift to zero.
+ *
+ * @param exposure Exposure of the shift.
+ * @param shift Number of the shift, in days since 1970.
+ */
+void SPL_reset_exposure(spl_exposure_t *exposure, uint32_t shift);
+
+/**
+ * Add a recording to the exposure of the shift.
+ *
+ * Add the energy, duration and dose of the recording to the shift in
+ * which it starts, starting again if it is a new shift, and append a line
+ * to the dose log file with the start time of the recording, LEX,8h, the
+ * dose and the dose projected to the reference duration in percent and
+ * the hours measured in the shift.
+ *
+ * @param state SPL pipeline state, after SPL_to_dB.
+ * @param exposure Exposure of the shift.
+ * @param currentTime Time when the record process started.
+ * @param localTime Local time when the record process started.
+ * @param duration Duration of the recording in seconds.
+ */
+void SPL_update_exposure(spl_state_t *state, spl_exposure_t *exposure,
+		uint32_t currentTime, uint32_t localTime, uint32_t duration);
+
+/**
+ * Convert a float value to string.
+ *
+ * Write the value with four decimals followed by a space, as it is
+ * written in the log files.
+ *
+ * @param string Destination buffer (LOG_BUFFER_LENGTH).
+ * @param value Value to convert.
  */
-void SPL_write_log(uint32_t currentTime);
+void float_to_string(char* string, float value);
 
 #endif /* INC_SPL_H_ */
@@ -96,6 +96,7 @@ STATIC_UBUF(transmitBuffer, 2 * AM_USB_BUFFERSIZE);
 
 static FATFS fatfs;
 static FIL file;
+static FIL auxiliaryFiles[AM_NUMBER_OF_AUXILIARY_FILES];
 static UINT bw;
 
 /* DMA variables */
@@ -1762,6 +1763,81 @@ bool AudioMoth_closeFile(void) {
 
 }
 
+/* Auxiliary files, written alongside the main file */
+
+bool AudioMoth_openAuxiliaryFile(uint32_t index, char *filename) {
+
+    if (index >= AM_NUMBER_OF_AUXILIARY_FILES) {
+        return false;
+    }
+
+    FRESULT res = f_open(auxiliaryFiles + index, filename,  FA_CREATE_ALWAYS | FA_WRITE);
+
+    if (res != FR_OK) {
+        return false;
+    }
+
+    return true;
+
+}
+
+bool AudioMoth_appendAuxiliaryFile(uint32_t index, char *filename) {
+
+    if (index >= AM_NUMBER_OF_AUXILIARY_FILES) {
+        return false;
+    }
+
+    /* Open the file for writing. Append existing file with the same name */
+
+    FRESULT res = f_open(auxiliaryFiles + index, filename,  FA_OPEN_ALWAYS | FA_WRITE);
+
+    if (res != FR_OK) {
+        return false;
+    }
+
+    res = f_lseek(auxiliaryFiles + index, f_size(auxiliaryFiles + index));
+
+    if (res != FR_OK) {
+        f_close(auxiliaryFiles + index);
+        return false;
+    }
+
+    return true;
+
+}
+
+bool AudioMoth_writeToAuxiliaryFile(uint32_t index, void *bytes, uint16_t bytesToWrite) {
+
+    if (index >= AM_NUMBER_OF_AUXILIARY_FILES) {
+        return false;
+    }
+
+    FRESULT res = f_write(auxiliaryFiles + index, bytes, bytesToWrite, &bw);
+
+    if ((res != FR_OK) || (bytesToWrite != bw)) {
+        return false;
+    }
+
+    return true;
+
+}
+
+bool AudioMoth_closeAuxiliaryFile(uint32_t index) {
+
+    if (index >= AM_NUMBER_OF_AUXILIARY_FILES) {
+        return false;
+    }
+
+    FRESULT res = f_close(auxiliaryFiles + index);
+
+    if (res != FR_OK) {
+        return false;
+    }
+
+    return true;
+
+}
+
 bool AudioMoth_renameFile(char *originalFilename, char *newFilename) {
 
     FRESULT res = f_rename(originalFilename, newFilename);
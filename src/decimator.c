@@ -0,0 +1,225 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        decimator.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Polyphase FIR decimator */
+#include <string.h>
+
+#include "decimator.h"
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+#include "em_device.h"
+#define DECIMATOR_DUAL_MAC                  1
+#else
+#define DECIMATOR_DUAL_MAC                  0
+#endif
+
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+/* Low pass taps in Q15 for each divider. Kaiser window (beta = 5) applied
+ * to a sinc with the cutoff at half the output rate, 16 taps per phase.
+ * The pass band droop is 0.03 dB at 0.4 times the output rate and the
+ * bands that alias into it are attenuated at least 47 dB (2), 49 dB (4),
+ * 51 dB (8) and 52 dB (16). The taps add to 32768 and the sum of their
+ * absolute values is below 1.8 * 32768, so the products of a full scale
+ * input add without overflow in 32 bits. */
+
+static const int16_t taps2[2 * DECIMATOR_TAPS_PER_PHASE] = {
+		-17, -36, 64, 102, -154, -221, 309, 421, -566, -754, 1005, 1354,
+		-1879, -2784, 4817, 14723, 14723, 4817, -2784, -1879, 1354, 1005,
+		-754, -566, 421, 309, -221, -154, 102, 64, -36, -17
+};
+
+static const int16_t taps4[4 * DECIMATOR_TAPS_PER_PHASE] = {
+		-5, -17, -23, -13, 17, 51, 64, 33, -40, -116, -138, -68, 80, 225,
+		262, 126, -145, -404, -466, -222, 256, 712, 825, 398, -468, -1348,
+		-1637, -848, 1110, 3803, 6396, 7984, 7984, 6396, 3803, 1110, -848,
+		-1637, -1348, -468, 398, 825, 712, 256, -222, -466, -404, -145, 126,
+		262, 225, 80, -68, -138, -116, -40, 33, 64, 51, 17, -13, -23, -17,
+		-5
+};
+
+static const int16_t taps8[8 * DECIMATOR_TAPS_PER_PHASE] = {
+		-1, -4, -7, -10, -12, -12, -9, -4, 4, 14, 23, 30, 34, 32, 23, 9,
+		-10, -31, -51, -66, -72, -66, -48, -18, 20, 61, 99, 126, 136, 124,
+		89, 34, -36, -110, -177, -224, -240, -218, -156, -59, 63, 193, 310,
+		393, 423, 387, 279, 106, -115, -355, -581, -751, -827, -777, -581,
+		-230, 263, 871, 1552, 2250, 2905, 3459, 3861, 4069, 4069, 3861,
+		3459, 2905, 2250, 1552, 871, 263, -230, -581, -777, -827, -751,
+		-581, -355, -115, 106, 279, 387, 423, 393, 310, 193, 63, -59, -156,
+		-218, -240, -224, -177, -110, -36, 34, 89, 124, 136, 126, 99, 61,
+		20, -18, -48, -66, -72, -66, -51, -31, -10, 9, 23, 32, 34, 30, 23,
+		14, 4, -4, -9, -12, -12, -10, -7, -4, -1
+};
+
+static const int16_t taps16[16 * DECIMATOR_TAPS_PER_PHASE] = {
+		0, -1, -2, -3, -3, -4, -5, -6, -6, -6, -6, -6, -5, -4, -3, -1, 1, 3,
+		6, 8, 10, 13, 15, 16, 17, 17, 17, 15, 13, 10, 7, 2, -2, -8, -13,
+		-18, -24, -28, -32, -35, -36, -36, -35, -32, -27, -21, -14, -5, 5,
+		15, 26, 36, 45, 54, 61, 66, 68, 68, 65, 59, 50, 39, 25, 9, -9, -27,
+		-46, -64, -81, -96, -108, -116, -120, -120, -114, -104, -88, -68,
+		-43, -15, 16, 48, 81, 113, 142, 168, 189, 204, 211, 211, 202, 183,
+		156, 121, 77, 27, -28, -87, -148, -208, -264, -315, -358, -390,
+		-410, -414, -402, -371, -322, -254, -166, -60, 64, 203, 355, 518,
+		689, 864, 1038, 1210, 1374, 1528, 1667, 1788, 1889, 1967, 2019,
+		2044, 2044, 2019, 1967, 1889, 1788, 1667, 1528, 1374, 1210, 1038,
+		864, 689, 518, 355, 203, 64, -60, -166, -254, -322, -371, -402,
+		-414, -410, -390, -358, -315, -264, -208, -148, -87, -28, 27, 77,
+		121, 156, 183, 202, 211, 211, 204, 189, 168, 142, 113, 81, 48, 16,
+		-15, -43, -68, -88, -104, -114, -120, -120, -116, -108, -96, -81,
+		-64, -46, -27, -9, 9, 25, 39, 50, 59, 65, 68, 68, 66, 61, 54, 45,
+		36, 26, 15, 5, -5, -14, -21, -27, -32, -35, -36, -36, -35, -32, -28,
+		-24, -18, -13, -8, -2, 2, 7, 10, 13, 15, 17, 17, 17, 16, 15, 13, 10,
+		8, 6, 3, 1, -1, -3, -4, -5, -6, -6, -6, -6, -6, -5, -4, -3, -3, -2,
+		-1, 0
+};
+
+/* Decimator functions */
+
+void DECIMATOR_reset(decimator_state_t *state) {
+	memset(state->history, 0, sizeof(state->history));
+	state->clipped = 0;
+}
+
+bool DECIMATOR_init(decimator_state_t *state, uint32_t divider,
+		int8_t bitsToShift) {
+
+	uint32_t log2Divider = 0;
+
+	switch (divider) {
+	case 2:
+		state->taps = taps2;
+		log2Divider = 1;
+		break;
+	case 4:
+		state->taps = taps4;
+		log2Divider = 2;
+		break;
+	case 8:
+		state->taps = taps8;
+		log2Divider = 3;
+		break;
+	case 16:
+		state->taps = taps16;
+		log2Divider = 4;
+		break;
+	default:
+		return false;
+	}
+
+	state->numberOfTaps = divider * DECIMATOR_TAPS_PER_PHASE;
+	state->divider = divider;
+
+	/* The taps have unit gain in Q15 and the boxcar a gain of divider
+	 * before the shift, the result is always a right shift of at least 11
+	 * bits as the oversampling never exceeds the bits of the sum */
+	state->shift = 15 - log2Divider - bitsToShift;
+
+	DECIMATOR_reset(state);
+
+	return true;
+}
+
+/* Dot product of the taps with the input, two products per instruction
+ * with the DSP extension */
+
+static inline int32_t dot_product(const int16_t *taps, const int16_t *x,
+		uint32_t n) {
+
+	int32_t acc = 0;
+
+#if DECIMATOR_DUAL_MAC
+
+	for (uint32_t k = 0; k < n; k += 4) {
+		uint32_t t0, t1, x0, x1;
+		memcpy(&t0, taps + k, 4);
+		memcpy(&t1, taps + k + 2, 4);
+		memcpy(&x0, x + k, 4);
+		memcpy(&x1, x + k + 2, 4);
+		acc = (int32_t) __SMLAD(t0, x0, (uint32_t) acc);
+		acc = (int32_t) __SMLAD(t1, x1, (uint32_t) acc);
+	}
+
+#else
+
+	for (uint32_t k = 0; k < n; k += 1) {
+		acc += (int32_t) taps[k] * (int32_t) x[k];
+	}
+
+#endif
+
+	return acc;
+}
+
+/* Output k uses the input from k * divider - historyLength, the input
+ * before the block is taken from the history */
+
+static inline void decimate(decimator_state_t *state, int16_t *buffer,
+		uint32_t n, int16_t *dest) {
+
+	uint32_t historyLength = state->numberOfTaps - state->divider;
+
+	int16_t *x = buffer - historyLength;
+
+	int32_t rounding = 1 << (state->shift - 1);
+
+	uint32_t clipped = 0;
+
+	/* Samples of the previous block in front of the block */
+
+	memcpy(x, state->history, historyLength * sizeof(int16_t));
+
+	memcpy(state->history, buffer + n - historyLength,
+			historyLength * sizeof(int16_t));
+
+	for (uint32_t i = 0, k = 0; i < n; i += state->divider, k += 1) {
+
+		int32_t sample = (dot_product(state->taps, x + i, state->numberOfTaps)
+				+ rounding) >> state->shift;
+
+#if DECIMATOR_DUAL_MAC
+		dest[k] = (int16_t) __SSAT(sample, 16);
+#else
+		dest[k] = (int16_t) MAX(INT16_MIN, MIN(INT16_MAX, sample));
+#endif
+
+		clipped += dest[k] != sample;
+
+	}
+
+	state->clipped += clipped;
+
+}
+
+int16_t* DECIMATOR_process_block(decimator_state_t *state, int16_t *buffer,
+		uint32_t n) {
+
+	/* The output is written from the start of the history, before every
+	 * sample it still needs */
+
+	int16_t *x = buffer - (state->numberOfTaps - state->divider);
+
+	decimate(state, buffer, n, x);
+
+	return x;
+
+}
+
+uint32_t DECIMATOR_copy_block(decimator_state_t *state, int16_t *buffer,
+		uint32_t n, int16_t *dest) {
+
+	decimate(state, buffer, n, dest);
+
+	return n / state->divider;
+
+}
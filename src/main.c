@@ -8,6 +8,9 @@
 
 #include "audioMoth.h"
 #include "spl.h"
+#include "octave.h"
+#include "decimator.h"
+#include "spectrum.h"
 
 #include <time.h>
 #include <stdio.h>
@@ -15,6 +18,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stdlib.h>
 
 
 /* Sleep and LED constants */
@@ -35,11 +39,12 @@
 #define SECONDS_IN_HOUR                     (60 * SECONDS_IN_MINUTE)
 #define SECONDS_IN_DAY                      (24 * SECONDS_IN_HOUR)
 
-/* SRAM buffer constants */
+/* SRAM buffer constants, the work memory of the spectrum goes after the
+ * buffers and each buffer holds a whole number of DMA transfers */
 
 #define NUMBER_OF_BUFFERS                   8
-#define EXTERNAL_SRAM_SIZE_IN_SAMPLES       (AM_EXTERNAL_SRAM_SIZE_IN_BYTES / 2)
-#define NUMBER_OF_SAMPLES_IN_BUFFER         (EXTERNAL_SRAM_SIZE_IN_SAMPLES / NUMBER_OF_BUFFERS)
+#define EXTERNAL_SRAM_SIZE_IN_SAMPLES       ((AM_EXTERNAL_SRAM_SIZE_IN_BYTES - SPECTRUM_SCRATCH_SIZE_IN_BYTES - SPL_SCRATCH_SIZE_IN_BYTES) / 2)
+#define NUMBER_OF_SAMPLES_IN_BUFFER         (EXTERNAL_SRAM_SIZE_IN_SAMPLES / NUMBER_OF_BUFFERS / NUMBER_OF_SAMPLES_IN_DMA_TRANSFER * NUMBER_OF_SAMPLES_IN_DMA_TRANSFER)
 #define NUMBER_OF_SAMPLES_IN_DMA_TRANSFER   1024
 #define NUMBER_OF_BUFFERS_TO_SKIP           1
 
@@ -79,6 +84,26 @@
     } \
 }
 
+/* Stop the samples and close the WAV and auxiliary files before returning
+ * from a recording. FatFs invalidates a file object that failed to open or
+ * was closed, so closing a file that is not open only fails harmlessly */
+
+#define RETURN_ON_RECORDING_ERROR(fn) { \
+    bool success = (fn); \
+    if (success != true) { \
+        AudioMoth_disableMicrophone(); \
+        AudioMoth_closeFile(); \
+        for (uint32_t i = 0; i < AM_NUMBER_OF_AUXILIARY_FILES; i += 1) { \
+            AudioMoth_closeAuxiliaryFile(i); \
+        } \
+        if (configSettings->enableBatteryCheck ) { \
+            AudioMoth_disableBatteryMonitor(); \
+        } \
+        FLASH_LED(Both, LONG_LED_FLASH_DURATION) \
+        return SDCARD_WRITE_ERROR; \
+    } \
+}
+
 #define SAVE_SWITCH_POSITION_AND_POWER_DOWN(duration) { \
     *previousSwitchPosition = switchPosition; \
     AudioMoth_powerDownAndWake(duration, true); \
@@ -311,6 +336,23 @@ static uint32_t *durationOfNextRecording =
 static configSettings_t *configSettings =
 		(configSettings_t*) (AM_BACKUP_DOMAIN_START_ADDRESS + 12);
 
+/* Day levels, kept between recordings in the first free word after the
+ * settings */
+
+static spl_rollup_t *rollup =
+		(spl_rollup_t*) (AM_BACKUP_DOMAIN_START_ADDRESS + 56);
+
+/* Gain of the next recording, chosen by the automatic gain ranging or
+ * the calibration */
+
+static uint32_t *autoGain =
+		(uint32_t*) (AM_BACKUP_DOMAIN_START_ADDRESS + 92);
+
+/* Noise exposure of the shift, kept between recordings after the gain */
+
+static spl_exposure_t *exposure =
+		(spl_exposure_t*) (AM_BACKUP_DOMAIN_START_ADDRESS + 96);
+
 /* DC filter variables */
 
 static int8_t bitsToShift;
@@ -329,15 +371,71 @@ static int16_t* buffers[NUMBER_OF_BUFFERS];
 
 static volatile bool switchPositionChanged;
 
-/* DMA buffers */
+/* DMA buffers, the samples kept by the decimator go in front of them */
+
+static int16_t primaryBuffer[DECIMATOR_HISTORY_LENGTH
+		+ NUMBER_OF_SAMPLES_IN_DMA_TRANSFER];
+static int16_t secondaryBuffer[DECIMATOR_HISTORY_LENGTH
+		+ NUMBER_OF_SAMPLES_IN_DMA_TRANSFER];
+
+/* Decimator state */
+
+static decimator_state_t decimatorState;
+
+static bool useDecimator;
+
+/* Decimator of the SPL pipeline, from the samples of the microphone */
+
+static decimator_state_t analysisDecimatorState;
+
+static bool useAnalysisDecimator;
+
+static uint32_t analysisDivider;
+
+static int8_t analysisBitsToShift;
+
+static bool analysisSharesRecording;
 
-static int16_t primaryBuffer[NUMBER_OF_SAMPLES_IN_DMA_TRANSFER];
-static int16_t secondaryBuffer[NUMBER_OF_SAMPLES_IN_DMA_TRANSFER];
+/* SPL pipeline state and input buffer, the samples kept by the decimator
+ * of the tone detector go in front of it */
+
+static spl_state_t splState;
+
+static int16_t analysisBuffer[DECIMATOR_HISTORY_LENGTH
+		+ NUMBER_OF_SAMPLES_IN_DMA_TRANSFER];
+
+static int16_t *splBuffer = analysisBuffer + DECIMATOR_HISTORY_LENGTH;
+
+/* Decimator of the tone detector, from the samples of the SPL pipeline */
+
+static decimator_state_t toneDecimatorState;
+
+static bool useToneDecimator;
+
+static uint32_t toneDivider;
+
+/* Octave band filter bank state */
+
+static octave_state_t octaveState;
+
+/* Power spectral density state */
+
+static spectrum_state_t spectrumState;
 
 /* Current recording file name */
 
 static char fileName[20];
 
+static char intervalFileName[20];
+
+static char spectrumFileName[20];
+
+static char ltsaFileName[20];
+
+static char eventFileName[20];
+
+static char calibrationFileName[32];
+
 /* Firmware version and description */
 
 static uint8_t firmwareVersion[AM_FIRMWARE_VERSION_LENGTH] = { 1, 0, 0 };
@@ -348,6 +446,8 @@ static uint8_t firmwareDescription[AM_FIRMWARE_DESCRIPTION_LENGTH] =
 /* Function prototypes */
 
 static void flashLedToIndicateBatteryLife(void);
+static int8_t calculateBitsToShift(uint32_t oversampling);
+static uint32_t decimateForAnalysis(int16_t *source, uint32_t size);
 static void filter(int16_t *source, int16_t *dest, uint8_t sampleRateDivider,
 		uint32_t size);
 static void scheduleRecording(uint32_t currentTime,
@@ -388,17 +488,6 @@ int main(void) {
 
 	AudioMoth_initialise();
 
-	/* Find sampling rate */
-	float fs = configSettings->sampleRate / configSettings->sampleRateDivider;
-
-	/* Init dBA filter variables */
-	SPL_init_A_weighting_filter(fs);
-	SPL_find_calibration_offset(configSettings->gain);
-
-	/* init compensation filter */
-	SPL_init_compensation_filter(fs);
-
-
 	AM_switchPosition_t switchPosition = AudioMoth_getSwitchPosition();
 
 	if (AudioMoth_isInitialPowerUp()) {
@@ -409,9 +498,15 @@ int main(void) {
 
 		*previousSwitchPosition = AM_SWITCH_NONE;
 
+		SPL_reset_rollup(rollup, 0);
+
+		SPL_reset_exposure(exposure, 0);
+
 		copyToBackupDomain((uint32_t*) configSettings,
 				(uint8_t*) &defaultConfigSettings, sizeof(configSettings_t));
 
+		*autoGain = configSettings->gain;
+
 	} else {
 
 		/* Indicate battery state is not initial power up and switch has been moved into USB if enabled */
@@ -573,10 +668,10 @@ inline void AudioMoth_handleMicrophoneInterrupt(int16_t sample) {
 inline void AudioMoth_handleDirectMemoryAccessInterrupt(bool isPrimaryBuffer,
 		int16_t **nextBuffer) {
 
-	int16_t *source = secondaryBuffer;
+	int16_t *source = secondaryBuffer + DECIMATOR_HISTORY_LENGTH;
 
 	if (isPrimaryBuffer)
-		source = primaryBuffer;
+		source = primaryBuffer + DECIMATOR_HISTORY_LENGTH;
 
 	/* Update the current buffer index and write buffer */
 
@@ -656,6 +751,10 @@ inline void AudioMoth_usbApplicationPacketReceived(uint32_t messageType,
 	copyToBackupDomain((uint32_t*) configSettings, receiveBuffer + 1,
 			sizeof(configSettings_t));
 
+	/* Start the automatic gain ranging from the configured gain */
+
+	*autoGain = configSettings->gain;
+
 	/* Copy the back-up register data structure to the USB packet */
 
 	copyFromBackupDomain(transmitBuffer + 1, (uint32_t*) configSettings,
@@ -673,11 +772,51 @@ static void filter(int16_t *source, int16_t *dest, uint8_t sampleRateDivider,
 		uint32_t size) {
 
 	int32_t filteredOutput;
-	float filteredOutput_A;
 	int32_t scaledPreviousFilterOutput;
 
+	int8_t shift = bitsToShift;
+
 	int index = 0;
 
+	/* Samples of the SPL pipeline, before the recorded samples are
+	 * decimated in place. At the rate of the recording they are taken
+	 * from the recorded samples. */
+
+	uint32_t analysisSize = size / sampleRateDivider;
+
+	if (!analysisSharesRecording) {
+
+		analysisSize = decimateForAnalysis(source, size);
+
+	}
+
+	/* The decimator leaves the samples at the output rate and scale */
+
+	if (useDecimator) {
+
+		source = DECIMATOR_process_block(&decimatorState, source, size);
+
+		size /= sampleRateDivider;
+
+		sampleRateDivider = 1;
+
+		shift = 0;
+
+	}
+
+	/* Statistics of the recorded samples, after the DC filter so that the
+	 * offset of the microphone does not hide the samples under range */
+
+	uint32_t saturated = 0;
+	uint32_t nearFullScale = 0;
+	uint32_t underRange = 0;
+	uint32_t clipped = 0;
+
+	uint32_t peak = splState.samplePeak;
+
+	uint32_t burst = splState.overloadBurst;
+	uint32_t longestBurst = splState.longestOverloadBurst;
+
 	for (int i = 0; i < size; i += sampleRateDivider) {
 
 		int32_t sample = 0;
@@ -688,11 +827,11 @@ static void filter(int16_t *source, int16_t *dest, uint8_t sampleRateDivider,
 
 		}
 
-		if (bitsToShift > 0)
-			sample <<= bitsToShift;
+		if (shift > 0)
+			sample <<= shift;
 
-		if (bitsToShift < 0)
-			sample >>= -bitsToShift;
+		if (shift < 0)
+			sample >>= -shift;
 
 		scaledPreviousFilterOutput = (int32_t) (DC_BLOCKING_FACTOR
 				* (float) previousFilterOutput);
@@ -702,28 +841,51 @@ static void filter(int16_t *source, int16_t *dest, uint8_t sampleRateDivider,
 		/* uncomment to save original signal*/
 		//filteredOutput = sample;
 
-		float const_normalize = 3276.8f;
-		float input;// = (float)sample / const_normalize;
+		/* The SPL pipeline takes 16 bit samples, so the sum is clamped. The
+		 * 12 bit conversions only exceed the range when the oversampling
+		 * times the divider is not a power of two. */
+
+		if (analysisSharesRecording) {
+
+			int16_t clampedSample = (int16_t) MAX(INT16_MIN, MIN(INT16_MAX, sample));
+
+			clipped += clampedSample != sample;
+
+			splBuffer[index] = clampedSample;
+
+		}
+
+		/* The recorded samples clamped to the 16 bit range count as
+		 * saturated and at full scale */
 
-		input = SPL_compensation_mic_filter_step((float)sample / const_normalize);
-		filteredOutput_A = SPL_A_weighting_filter_step(input);
-		SPL_update_value(filteredOutput_A);
+		if (filteredOutput > INT16_MAX || filteredOutput < INT16_MIN) {
 
-		/* uncomment to save the A weighted signal*/
-		//filteredOutput = const_normalize * filteredOutput_A;
+			dest[index++] = filteredOutput > INT16_MAX ? INT16_MAX : INT16_MIN;
 
-		if (filteredOutput > INT16_MAX) {
+			saturated += 1;
 
-			dest[index++] = INT16_MAX;
+			burst += 1;
 
-		} else if (filteredOutput < INT16_MIN) {
+			longestBurst = MAX(longestBurst, burst);
 
-			dest[index++] = INT16_MIN;
+			nearFullScale += 1;
+
+			peak = (uint32_t) -INT16_MIN;
 
 		} else {
 
 			dest[index++] = (int16_t) filteredOutput;
 
+			uint32_t magnitude = abs(filteredOutput);
+
+			nearFullScale += magnitude >= SPL_NEAR_FULL_SCALE;
+
+			underRange += magnitude <= SPL_NOISE_FLOOR;
+
+			peak = MAX(peak, magnitude);
+
+			burst = 0;
+
 		}
 
 		previousFilterOutput = filteredOutput;
@@ -732,6 +894,110 @@ static void filter(int16_t *source, int16_t *dest, uint8_t sampleRateDivider,
 
 	}
 
+	splState.samplesCounted += index;
+	splState.samplesSaturated += saturated;
+	splState.samplesNearFullScale += nearFullScale;
+	splState.samplesUnderRange += underRange;
+	splState.samplesClipped += clipped;
+	splState.samplePeak = peak;
+	splState.overloadBurst = burst;
+	splState.longestOverloadBurst = longestBurst;
+
+	/* Compensation filter, A-weighting filter and SPL value */
+
+	SPL_process_block(&splState, splBuffer, analysisSize);
+
+	/* Octave band levels */
+
+	OCTAVE_process_block(&octaveState, splBuffer, analysisSize);
+
+	/* Tone frames, last since the decimator writes over the samples */
+
+	int16_t *toneSamples = splBuffer;
+
+	if (useToneDecimator) {
+
+		toneSamples = DECIMATOR_process_block(&toneDecimatorState, splBuffer,
+				analysisSize);
+
+		analysisSize /= toneDivider;
+
+	}
+
+	SPECTRUM_add_tone_samples(&spectrumState, toneSamples, analysisSize);
+
+}
+
+/* Decimate the samples of the microphone to the rate of the SPL pipeline,
+ * with the same scale as the recorded samples */
+static uint32_t decimateForAnalysis(int16_t *source, uint32_t size) {
+
+	if (useAnalysisDecimator) {
+
+		uint32_t n = DECIMATOR_copy_block(&analysisDecimatorState, source,
+				size, splBuffer);
+
+		splState.samplesClipped += analysisDecimatorState.clipped;
+
+		analysisDecimatorState.clipped = 0;
+
+		return n;
+
+	}
+
+	uint32_t index = 0;
+
+	uint32_t clipped = 0;
+
+	for (uint32_t i = 0; i < size; i += analysisDivider) {
+
+		int32_t sample = 0;
+
+		for (uint32_t j = 0; j < analysisDivider; j += 1) {
+
+			sample += (int32_t) source[i + j];
+
+		}
+
+		if (analysisBitsToShift > 0)
+			sample <<= analysisBitsToShift;
+
+		if (analysisBitsToShift < 0)
+			sample >>= -analysisBitsToShift;
+
+		/* Clamped to 16 bits as in filter() */
+
+		int16_t clampedSample = (int16_t) MAX(INT16_MIN, MIN(INT16_MAX, sample));
+
+		clipped += clampedSample != sample;
+
+		splBuffer[index++] = clampedSample;
+
+	}
+
+	splState.samplesClipped += clipped;
+
+	return index;
+
+}
+
+/* Shift that scales the sum of oversampling conversions to the sum of 16 */
+static int8_t calculateBitsToShift(uint32_t oversampling) {
+
+	int8_t bits = 0;
+
+	while (oversampling > 16) {
+		oversampling >>= 1;
+		bits -= 1;
+	}
+
+	while (oversampling < 16) {
+		oversampling <<= 1;
+		bits += 1;
+	}
+
+	return bits;
+
 }
 
 
@@ -752,23 +1018,110 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 		buffers[i] = buffers[i - 1] + NUMBER_OF_SAMPLES_IN_BUFFER;
 	}
 
-	/* Calculate the bits to shift */
+	/* Work memory of the spectrum and of the SPL pipeline after the
+	 * buffers, enabled before the pipeline clears it */
 
-	bitsToShift = 0;
+	spectrum_scratch_t *spectrumScratch =
+			(spectrum_scratch_t*) (buffers[NUMBER_OF_BUFFERS - 1]
+					+ NUMBER_OF_SAMPLES_IN_BUFFER);
 
-	uint16_t oversampling = configSettings->oversampleRate
-			* configSettings->sampleRateDivider;
+	spl_scratch_t *splScratch = (spl_scratch_t*) (spectrumScratch + 1);
 
-	while (oversampling > 16) {
-		oversampling >>= 1;
-		bitsToShift -= 1;
+	AudioMoth_enableExternalSRAM();
+
+	/* Rate of the SPL pipeline, the largest divider that keeps at least
+	 * SPL_ANALYSIS_SAMPLE_RATE whatever the rate of the recording */
+
+#if SPL_ANALYSIS_SAMPLE_RATE > 0
+
+	analysisDivider = 1;
+
+	while (analysisDivider < DECIMATOR_MAX_DIVIDER
+			&& configSettings->sampleRate / (2 * analysisDivider)
+					>= SPL_ANALYSIS_SAMPLE_RATE) {
+		analysisDivider <<= 1;
 	}
 
-	while (oversampling < 16) {
-		oversampling <<= 1;
-		bitsToShift += 1;
+#else
+
+	analysisDivider = configSettings->sampleRateDivider;
+
+#endif
+
+	/* Gain of the recording */
+
+#if SPL_AUTO_GAIN || SPL_CALIBRATION
+
+	uint32_t gain = *autoGain;
+
+#else
+
+	uint32_t gain = configSettings->gain;
+
+#endif
+
+	/* Initialise the SPL pipeline only when a recording is made */
+
+	float fs = configSettings->sampleRate / analysisDivider;
+
+	/* Offsets measured with the calibrator on this device */
+
+	sprintf(calibrationFileName, "CAL_%08X%08X.TXT",
+			(unsigned int) *((uint32_t*) AM_UNIQUE_ID_START_ADDRESS + 1),
+			(unsigned int) *((uint32_t*) AM_UNIQUE_ID_START_ADDRESS));
+
+	SPL_read_calibration(calibrationFileName);
+
+	SPL_init_A_weighting_filter(&splState, splScratch, fs);
+	SPL_find_calibration_offset(&splState, gain);
+
+	SPL_init_compensation_filter(&splState, fs);
+
+	OCTAVE_init_filter_bank(&octaveState, fs);
+
+	/* Rate of the tone detector, the SPL pipeline halved while it is above
+	 * SPECTRUM_TONE_SAMPLE_RATE, decimated with unit gain */
+
+	toneDivider = 1;
+
+	int8_t toneBitsToShift = 0;
+
+	while (fs / toneDivider > SPECTRUM_TONE_SAMPLE_RATE) {
+		toneDivider <<= 1;
+		toneBitsToShift -= 1;
 	}
 
+	useToneDecimator = SPECTRUM_TONES && toneDivider > 1
+			&& DECIMATOR_init(&toneDecimatorState, toneDivider,
+					toneBitsToShift);
+
+	/* Calculate the bits to shift */
+
+	bitsToShift = calculateBitsToShift(
+			configSettings->oversampleRate
+					* configSettings->sampleRateDivider);
+
+	analysisBitsToShift = calculateBitsToShift(
+			configSettings->oversampleRate * analysisDivider);
+
+	/* Decimate with the FIR low pass when there are taps for the divider */
+
+	useDecimator = DECIMATOR_TYPE == DECIMATOR_FIR
+			&& DECIMATOR_init(&decimatorState,
+					configSettings->sampleRateDivider, bitsToShift);
+
+	/* The SPL pipeline is always decimated with the FIR low pass when it
+	 * has its own rate */
+
+	useAnalysisDecimator = (SPL_ANALYSIS_SAMPLE_RATE > 0
+			|| DECIMATOR_TYPE == DECIMATOR_FIR)
+			&& DECIMATOR_init(&analysisDecimatorState, analysisDivider,
+					analysisBitsToShift);
+
+	analysisSharesRecording = analysisDivider
+			== configSettings->sampleRateDivider
+			&& useAnalysisDecimator == useDecimator;
+
 	/* Calculate recording parameters */
 
 	uint32_t numberOfSamplesInHeader = sizeof(wavHeader) >> 1;
@@ -786,15 +1139,19 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 
 	}
 
-	/* Initialise microphone for recording */
+	/* Initialise the spectrum and the microphone for recording */
 
-	AudioMoth_enableExternalSRAM();
+	SPECTRUM_init(&spectrumState, spectrumScratch,
+			configSettings->sampleRate / configSettings->sampleRateDivider,
+			fs / toneDivider);
 
-	AudioMoth_enableMicrophone(configSettings->gain,
+	AudioMoth_enableMicrophone(gain,
 			configSettings->clockDivider, configSettings->acquisitionCycles,
 			configSettings->oversampleRate);
 
-	AudioMoth_initialiseDirectMemoryAccess(primaryBuffer, secondaryBuffer,
+	AudioMoth_initialiseDirectMemoryAccess(
+			primaryBuffer + DECIMATOR_HISTORY_LENGTH,
+			secondaryBuffer + DECIMATOR_HISTORY_LENGTH,
 			NUMBER_OF_SAMPLES_IN_DMA_TRANSFER);
 
 	AudioMoth_startMicrophoneSamples(configSettings->sampleRate);
@@ -807,7 +1164,7 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 
 	}
 
-	RETURN_ON_ERROR(AudioMoth_enableFileSystem());
+	RETURN_ON_RECORDING_ERROR(AudioMoth_enableFileSystem());
 
 	/* Open a file with the current local time as the name */
 
@@ -821,7 +1178,35 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 			time->tm_mon + 1, time->tm_mday, time->tm_hour, time->tm_min,
 			time->tm_sec);
 
-	RETURN_ON_ERROR(AudioMoth_openFile(fileName));
+	RETURN_ON_RECORDING_ERROR(AudioMoth_openFile(fileName));
+
+	/* Open the short interval Leq file with the same name */
+
+	strcpy(intervalFileName, fileName);
+
+	strcpy(intervalFileName + strlen(intervalFileName) - 3, "LEQ");
+
+	RETURN_ON_RECORDING_ERROR(
+			SPL_open_interval_file(&splState, intervalFileName,
+					currentTime));
+
+	/* Open the noise event file of the day */
+
+	strncpy(eventFileName, fileName, 8);
+
+	strcpy(eventFileName + 8, ".EVT");
+
+	RETURN_ON_RECORDING_ERROR(
+			SPL_open_event_file(&splState, eventFileName, currentTime));
+
+	/* Open the long-term spectral average file with the same name */
+
+	strcpy(ltsaFileName, fileName);
+
+	strcpy(ltsaFileName + strlen(ltsaFileName) - 3, "LTS");
+
+	RETURN_ON_RECORDING_ERROR(
+			SPECTRUM_open_ltsa_file(&spectrumState, ltsaFileName, currentTime));
 
 	AudioMoth_setRedLED(false);
 
@@ -866,10 +1251,29 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 
 			}
 
-			RETURN_ON_ERROR(
+			RETURN_ON_RECORDING_ERROR(
 					AudioMoth_writeToFile(buffers[readBuffer],
 							2 * numberOfSamplesToWrite));
 
+			/* Add the written samples to the spectrum */
+
+			SPECTRUM_process_block(&spectrumState, buffers[readBuffer],
+					numberOfSamplesToWrite);
+
+			SPECTRUM_process_tones(&spectrumState);
+
+			/* Write the completed short interval Leq values */
+
+			RETURN_ON_RECORDING_ERROR(SPL_write_intervals(&splState));
+
+			/* Write the completed noise events */
+
+			RETURN_ON_RECORDING_ERROR(SPL_write_events(&splState));
+
+			/* Write the completed long-term spectral average columns */
+
+			RETURN_ON_RECORDING_ERROR(SPECTRUM_write_ltsa(&spectrumState));
+
 			/* Increment buffer counters */
 
 			readBuffer = (readBuffer + 1) & (NUMBER_OF_BUFFERS - 1);
@@ -893,12 +1297,21 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 
 		}
 
+		/* Transform the tone frame completed since the last buffer */
+
+		SPECTRUM_process_tones(&spectrumState);
+
 		/* Sleep until next DMA transfer is complete */
 
 		AudioMoth_sleep();
 
 	}
 
+	/* Stop the DMA transfers, so that the interrupt does not update the
+	 * levels, the intervals and the events while their files are closed */
+
+	AudioMoth_disableMicrophone();
+
 	/* Disable battery check */
 
 	if (configSettings->enableBatteryCheck) {
@@ -917,7 +1330,7 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 
 	setHeaderComment(currentTime, configSettings->timezoneHours,
 			configSettings->timezoneMinutes,
-			(uint8_t*) AM_UNIQUE_ID_START_ADDRESS, configSettings->gain,
+			(uint8_t*) AM_UNIQUE_ID_START_ADDRESS, gain,
 			batteryState, batteryVoltageLow, switchPositionChanged);
 
 	/* Write the header */
@@ -928,13 +1341,20 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 
 	}
 
-	RETURN_ON_ERROR(AudioMoth_seekInFile(0));
+	RETURN_ON_RECORDING_ERROR(AudioMoth_seekInFile(0));
 
-	RETURN_ON_ERROR(AudioMoth_writeToFile(&wavHeader, sizeof(wavHeader)));
+	RETURN_ON_RECORDING_ERROR(
+			AudioMoth_writeToFile(&wavHeader, sizeof(wavHeader)));
 
 	/* Close the file */
 
-	RETURN_ON_ERROR(AudioMoth_closeFile());
+	RETURN_ON_RECORDING_ERROR(AudioMoth_closeFile());
+
+	RETURN_ON_RECORDING_ERROR(SPL_close_interval_file(&splState));
+
+	RETURN_ON_RECORDING_ERROR(SPL_close_event_file(&splState));
+
+	RETURN_ON_RECORDING_ERROR(SPECTRUM_close_ltsa_file(&spectrumState));
 
 	AudioMoth_setRedLED(false);
 
@@ -946,13 +1366,56 @@ static AM_recordingState_t makeRecording(uint32_t currentTime,
 	if (switchPositionChanged)
 		return SWITCH_CHANGED;
 
-	/* Convert SPL to dB and save value to log file*/
-	SPL_to_dB();
-	SPL_write_log(currentTime);
+	/* Convert SPL to dB and save value to log file with the ecoacoustic
+	 * indices, if they are built */
+	SPL_to_dB(&splState);
+	SPECTRUM_to_indices(&spectrumState);
+	SPL_write_log(&splState, currentTime, spectrumState.indices,
+			SPECTRUM_INDICES ? SPECTRUM_NUMBER_OF_INDICES : 0);
+
+#if SPL_CALIBRATION
+
+	/* Save the offset if the calibrator was recorded and calibrate the
+	 * next gain with the next recording */
+	if (SPL_calibrate(&splState, gain)) {
+		SPL_write_calibration(calibrationFileName);
+	}
+
+	*autoGain = (gain + 1) % SPL_NUMBER_OF_GAINS;
+
+#elif SPL_AUTO_GAIN
+
+	/* Choose the gain of the next recording from the levels */
+	*autoGain = SPL_find_next_gain(&splState, gain);
+
+#endif
+
+	/* Add the recording to the day levels and to the exposure of the shift
+	 * in local time */
+	uint32_t duration = (samplesWritten - numberOfSamplesInHeader)
+			/ (configSettings->sampleRate / configSettings->sampleRateDivider);
+
+	SPL_update_rollup(&splState, rollup, (uint32_t) rawtime, duration);
+
+	SPL_update_exposure(&splState, exposure, currentTime, (uint32_t) rawtime,
+			duration);
+
+	/* Save the band levels to their log file */
+	OCTAVE_to_dB(&octaveState, &splState);
+	OCTAVE_write_log(&octaveState, currentTime);
+
+	/* Save the spectrum to a file with the same name */
+	strcpy(spectrumFileName, fileName);
+	strcpy(spectrumFileName + strlen(spectrumFileName) - 3, "PSD");
+	SPECTRUM_write_file(&spectrumState, spectrumFileName, currentTime);
+
+	/* Save the tonal components to their log file */
+	SPECTRUM_write_tones(&spectrumState, currentTime);
 
 	/* Reset filters */
-	SPL_reset_A_weighting_filter();
-	SPL_reset_compensation_filter();
+	SPL_reset_A_weighting_filter(&splState);
+	SPL_reset_compensation_filter(&splState);
+	OCTAVE_reset_filter_bank(&octaveState);
 
 	return RECORDING_OKAY;
 
@@ -0,0 +1,438 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        octave.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Octave and third-octave band filter bank */
+#include "octave.h"
+#include "audioMoth.h"
+
+/* file name and buffer for SD memory */
+static char logFilename[] = "BANDS.log";
+static char logBuffer[LOG_BUFFER_LENGTH];
+
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+/* Coefficients of the allpass sections of the half-band low pass, the
+ * even ones in the path of the later sample of each pair and the odd ones
+ * in the path of the earlier sample. Elliptic design with 4 coefficients
+ * and a transition band from 0.118 to 0.382 times the input rate
+ * (Valenzuela and Constantinides). */
+static const float decimationCoefficients[OCTAVE_DECIMATION_COEFFICIENTS] = {
+		0.0663150708f, 0.2448161035f, 0.4964625472f, 0.8081139839f
+};
+
+/* Complex numbers for the filter design */
+
+typedef struct {
+	double re;
+	double im;
+} complex_t;
+
+static complex_t complex_multiply(complex_t a, complex_t b) {
+	return (complex_t) { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+}
+
+static complex_t complex_divide(complex_t a, complex_t b) {
+	double d = b.re * b.re + b.im * b.im;
+	return (complex_t) { (a.re * b.re + a.im * b.im) / d,
+			(a.im * b.re - a.re * b.im) / d };
+}
+
+static complex_t complex_sqrt(complex_t a) {
+	double r = sqrt(sqrt(a.re * a.re + a.im * a.im));
+	double phi = 0.5 * atan2(a.im, a.re);
+	return (complex_t) { r * cos(phi), r * sin(phi) };
+}
+
+/* Bilinear transform of a pole pair s, conj(s) with the frequencies
+ * normalised to the sampling rate (2 fs = 2) */
+static void bilinear_pole_pair(complex_t s, float *a) {
+	complex_t z = complex_divide((complex_t) { 2.0 + s.re, s.im },
+			(complex_t) { 2.0 - s.re, -s.im });
+	a[0] = (float) (-2.0 * z.re);
+	a[1] = (float) (z.re * z.re + z.im * z.im);
+}
+
+/* Prewarped analog frequency of a normalised frequency */
+static double prewarp(double f) {
+	return 2.0 * tan(PI * f);
+}
+
+/* Fourth order Butterworth band pass between f1 and f2, two sections with
+ * numerator (1, 0, -1) and unit gain at the centre of the band */
+static void design_band_pass(octave_band_coefficients_t *c, double f1,
+		double f2) {
+	double w1 = prewarp(f1);
+	double w2 = prewarp(f2);
+	double bw = w2 - w1;
+	double w0 = sqrt(w1 * w2);
+
+	/* Pole of the second order low pass prototype, transformed by
+	 * s -> (s^2 + w0^2) / (bw s) */
+	complex_t p = { -sqrt(0.5) * bw, sqrt(0.5) * bw };
+	complex_t d = complex_sqrt((complex_t) {
+			p.re * p.re - p.im * p.im - 4.0 * w0 * w0, 2.0 * p.re * p.im });
+
+	bilinear_pole_pair((complex_t) { 0.5 * (p.re + d.re), 0.5 * (p.im + d.im) },
+			c->a[0]);
+	bilinear_pole_pair((complex_t) { 0.5 * (p.re - d.re), 0.5 * (p.im - d.im) },
+			c->a[1]);
+
+	/* Response at the centre of the band */
+	double omega = 2.0 * atan(0.5 * w0);
+	complex_t z1 = { cos(omega), -sin(omega) };
+	complex_t z2 = complex_multiply(z1, z1);
+	complex_t h = { 1.0, 0.0 };
+
+	for (uint32_t k = 0; k < 2; k += 1) {
+		complex_t num = { 1.0 - z2.re, -z2.im };
+		complex_t den = { 1.0 + c->a[k][0] * z1.re + c->a[k][1] * z2.re,
+				c->a[k][0] * z1.im + c->a[k][1] * z2.im };
+		h = complex_multiply(h, complex_divide(num, den));
+	}
+
+	c->gain = (float) (1.0 / sqrt(h.re * h.re + h.im * h.im));
+}
+
+/* Centre frequency of band k */
+static double band_frequency(int32_t k) {
+	return 1000.0 * pow(2.0, (double) k / OCTAVE_BANDS_PER_OCTAVE);
+}
+
+/* Index of the highest band with centre frequency not above f */
+static int32_t band_index(double f) {
+	return (int32_t) floor(OCTAVE_BANDS_PER_OCTAVE * log2(f / 1000.0) + 1e-6);
+}
+
+/* Design the band pass of band k at the sampling rate fs */
+static void design_band(octave_band_coefficients_t *c, int32_t k, double fs) {
+	double f = band_frequency(k);
+	double edge = pow(2.0, 0.5 / OCTAVE_BANDS_PER_OCTAVE);
+	design_band_pass(c, f / edge / fs, f * edge / fs);
+}
+
+/* Reset the filter bank */
+void OCTAVE_reset_filter_bank(octave_state_t *state) {
+	for (uint32_t s = 0; s < OCTAVE_MAX_STAGES; s += 1) {
+		memset(state->stages[s].x, 0, sizeof(state->stages[s].x));
+		memset(state->stages[s].y, 0, sizeof(state->stages[s].y));
+		state->stages[s].held = 0.0f;
+		state->stages[s].phase = 0;
+		state->stages[s].n = 0;
+	}
+	for (uint32_t i = 0; i < OCTAVE_MAX_BANDS; i += 1) {
+		memset(state->w[i], 0, sizeof(state->w[i]));
+		state->energy[i] = 0.0;
+		state->level[i] = 0.0f;
+	}
+}
+
+/* Init the filter bank */
+void OCTAVE_init_filter_bank(octave_state_t *state, float fs) {
+
+	state->fs = fs;
+
+	/* Decimate the higher rates to the first stage rate */
+	double rate = fs;
+
+	state->numberOfDecimationStages = 0;
+
+	while (rate > OCTAVE_MAX_STAGE_RATE) {
+		rate /= 2.0;
+		state->numberOfDecimationStages += 1;
+	}
+
+	/* Bands above the shared octave, filtered at the first stage rate with
+	 * their own coefficients. Their upper edge stays below the Nyquist
+	 * frequency. */
+	double edge = pow(2.0, 0.5 / OCTAVE_BANDS_PER_OCTAVE);
+	int32_t top = band_index(OCTAVE_STAGE_TOP * rate);
+	int32_t highest = band_index(MIN(OCTAVE_MAX_FREQUENCY, 0.48 * rate / edge));
+
+	state->numberOfTopBands = MAX(0, MIN(highest - top, OCTAVE_BANDS_PER_OCTAVE));
+	state->numberOfBands = 0;
+
+	for (uint32_t j = 0; j < state->numberOfTopBands; j += 1) {
+		int32_t k = top + (int32_t) (state->numberOfTopBands - j);
+		design_band(state->topBands + j, k, rate);
+		state->frequency[state->numberOfBands++] = (float) band_frequency(k);
+	}
+
+	/* Octave shared by all the stages, from the highest band */
+	for (uint32_t j = 0; j < OCTAVE_BANDS_PER_OCTAVE; j += 1) {
+		design_band(state->sharedBands + j, top - (int32_t) j, rate);
+	}
+
+	/* One octave per stage down to the lowest band */
+	uint32_t s = state->numberOfDecimationStages;
+
+	while (s < OCTAVE_MAX_STAGES && band_frequency(top) >= OCTAVE_MIN_FREQUENCY) {
+
+		uint32_t first = 0;
+
+		while (first < OCTAVE_BANDS_PER_OCTAVE
+				&& band_frequency(top - (int32_t) first) > OCTAVE_MAX_FREQUENCY) {
+			first += 1;
+		}
+
+		uint32_t bands = first;
+
+		while (bands < OCTAVE_BANDS_PER_OCTAVE
+				&& band_frequency(top - (int32_t) bands) >= OCTAVE_MIN_FREQUENCY
+				&& state->numberOfBands < OCTAVE_MAX_BANDS) {
+			state->frequency[state->numberOfBands++] =
+					(float) band_frequency(top - (int32_t) bands);
+			bands += 1;
+		}
+
+		state->stages[s].firstBand = first;
+		state->stages[s].numberOfBands = bands - first;
+
+		top -= OCTAVE_BANDS_PER_OCTAVE;
+		s += 1;
+	}
+
+	state->numberOfStages = s;
+
+	OCTAVE_reset_filter_bank(state);
+}
+
+/* Band pass a block, returns the sum of the squared output */
+static float filter_band(const octave_band_coefficients_t *c, float w[2][2],
+		const float *x, uint32_t n) {
+
+	const float a00 = c->a[0][0], a01 = c->a[0][1];
+	const float a10 = c->a[1][0], a11 = c->a[1][1];
+
+	float u1 = w[0][0], u2 = w[0][1];
+	float v1 = w[1][0], v2 = w[1][1];
+
+	float sum = 0.0f;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+		float u = x[i] - (a00 * u1 + a01 * u2);
+		float s1 = u - u2;
+		u2 = u1;
+		u1 = u;
+
+		float v = s1 - (a10 * v1 + a11 * v2);
+		float y = v - v2;
+		v2 = v1;
+		v1 = v;
+
+		sum += y * y;
+	}
+
+	w[0][0] = u1;
+	w[0][1] = u2;
+	w[1][0] = v1;
+	w[1][1] = v2;
+
+	return sum;
+}
+
+/* Half-band low pass and decimate by two in place, returns the number of
+ * outputs. Each pair of samples runs through the two paths of allpass
+ * sections, (c + z^-1) / (1 + c z^-1) at the output rate, and the output
+ * is the mean of the paths. */
+static uint32_t decimate(octave_stage_t *stage, float *x, uint32_t n) {
+
+	/* Load state into local variables */
+	float u[OCTAVE_DECIMATION_COEFFICIENTS];
+	float v[OCTAVE_DECIMATION_COEFFICIENTS];
+
+	memcpy(u, stage->x, sizeof(u));
+	memcpy(v, stage->y, sizeof(v));
+
+	const float *c = decimationCoefficients;
+
+	float held = stage->held;
+	uint32_t phase = stage->phase;
+	uint32_t m = 0;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+
+		if (phase == 0) {
+
+			held = x[i];
+
+		} else {
+
+			float later = x[i];
+			float earlier = held;
+
+			for (uint32_t k = 0; k < OCTAVE_DECIMATION_COEFFICIENTS; k += 2) {
+				float t0 = (later - v[k]) * c[k] + u[k];
+				u[k] = later;
+				v[k] = t0;
+				later = t0;
+
+				float t1 = (earlier - v[k + 1]) * c[k + 1] + u[k + 1];
+				u[k + 1] = earlier;
+				v[k + 1] = t1;
+				earlier = t1;
+			}
+
+			x[m++] = 0.5f * (later + earlier);
+
+		}
+
+		phase ^= 1;
+	}
+
+	memcpy(stage->x, u, sizeof(u));
+	memcpy(stage->y, v, sizeof(v));
+	stage->held = held;
+	stage->phase = phase;
+
+	return m;
+}
+
+/* Run a chunk of samples through the stages */
+static void process_chunk(octave_state_t *state, uint32_t n) {
+
+	float *x = state->buffer;
+	uint32_t band = 0;
+
+	for (uint32_t s = 0; s < state->numberOfStages && n > 0; s += 1) {
+
+		octave_stage_t *stage = state->stages + s;
+
+		if (s >= state->numberOfDecimationStages) {
+
+			stage->n += n;
+
+			if (s == state->numberOfDecimationStages) {
+				for (uint32_t j = 0; j < state->numberOfTopBands; j += 1) {
+					state->energy[band] += state->topBands[j].gain
+							* state->topBands[j].gain
+							* filter_band(state->topBands + j, state->w[band], x, n);
+					band += 1;
+				}
+			}
+
+			for (uint32_t j = stage->firstBand;
+					j < stage->firstBand + stage->numberOfBands; j += 1) {
+				state->energy[band] += state->sharedBands[j].gain
+						* state->sharedBands[j].gain
+						* filter_band(state->sharedBands + j, state->w[band], x, n);
+				band += 1;
+			}
+
+		}
+
+		if (s + 1 < state->numberOfStages) {
+			n = decimate(stage, x, n);
+		}
+
+	}
+
+}
+
+/* Process a block of samples */
+void OCTAVE_process_block(octave_state_t *state, const int16_t *src,
+		uint32_t n) {
+
+	while (n > 0) {
+
+		uint32_t m = MIN(n, OCTAVE_BUFFER_LENGTH);
+
+		for (uint32_t i = 0; i < m; i += 1) {
+			state->buffer[i] = (float) src[i];
+		}
+
+		process_chunk(state, m);
+
+		src += m;
+		n -= m;
+
+	}
+
+}
+
+/* Convert the band energies to dB */
+void OCTAVE_to_dB(octave_state_t *state, spl_state_t *spl) {
+
+	uint32_t band = 0;
+
+	for (uint32_t s = state->numberOfDecimationStages; s < state->numberOfStages;
+			s += 1) {
+
+		uint32_t bands = state->stages[s].numberOfBands;
+
+		if (s == state->numberOfDecimationStages) {
+			bands += state->numberOfTopBands;
+		}
+
+		for (uint32_t j = 0; j < bands; j += 1, band += 1) {
+
+			/* Response of the compensation filter at the centre of the band */
+			double omega = 2.0 * PI * state->frequency[band] / state->fs;
+			double c = cos(omega), s1 = sin(omega);
+			double num = (1.0 + spl->b_comp * c) * (1.0 + spl->b_comp * c)
+					+ spl->b_comp * s1 * spl->b_comp * s1;
+			double den = (1.0 + spl->a_comp * c) * (1.0 + spl->a_comp * c)
+					+ spl->a_comp * s1 * spl->a_comp * s1;
+			double gain = spl->G_comp * num / den / SPL_INPUT_NORMALIZATION;
+
+			double mean = 0.0;
+			if (state->stages[s].n > 0) {
+				mean = state->energy[band] / (double) state->stages[s].n;
+			}
+
+			state->level[band] = 10.0f * log10f((float) (gain * gain * mean))
+					+ spl->cal_offset;
+		}
+
+	}
+
+}
+
+/* Append the band levels to the log file */
+void OCTAVE_write_log(octave_state_t *state, uint32_t currentTime) {
+
+	AudioMoth_enableFileSystem();
+
+	AudioMoth_appendFile(logFilename);
+
+	struct tm *time = gmtime((time_t*) &currentTime);
+
+	sprintf(logBuffer, "%02d/%02d/%04d %02d:%02d:%02d: ", time->tm_mday,
+			time->tm_mon + 1, time->tm_year + 1900, time->tm_hour, time->tm_min,
+			time->tm_sec);
+
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	/* Lowest band and bands per octave */
+	float lowest = 0.0f;
+
+	if (state->numberOfBands > 0) {
+		lowest = state->frequency[state->numberOfBands - 1];
+	}
+
+	float_to_string(logBuffer, lowest);
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	sprintf(logBuffer, "%d ", OCTAVE_BANDS_PER_OCTAVE);
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	/* Band levels from the lowest band */
+	for (uint32_t i = state->numberOfBands; i > 0; i -= 1) {
+		float_to_string(logBuffer, state->level[i - 1]);
+		AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+	}
+
+	AudioMoth_writeToFile("\n", 1);
+
+	AudioMoth_closeFile();
+}
@@ -0,0 +1,1038 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        spectrum.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Welch power spectral density */
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "spectrum.h"
+#include "spl.h"
+#include "audioMoth.h"
+
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+/* Number of complex points of the FFT, the real frame is packed with the
+ * even samples as real part and the odd samples as imaginary part */
+#define SPECTRUM_FFT_LENGTH                 (SPECTRUM_LENGTH / 2)
+
+#if SPECTRUM_TONES
+static char toneFilename[] = "TONES.log";
+#endif
+
+/* Header of the spectrum file */
+
+#pragma pack(push, 1)
+
+typedef struct {
+	char id[4];
+	uint32_t time;
+	uint32_t sampleRate;
+	uint32_t frameLength;
+	uint32_t numberOfFrames;
+	uint32_t numberOfBins;
+} spectrumHeader_t;
+
+typedef struct {
+	char id[4];
+	uint32_t time;
+	uint32_t sampleRate;
+	uint32_t hop;
+	uint32_t framesPerColumn;
+	uint32_t numberOfBands;
+	int16_t minimumLevel;
+	uint16_t levelStep;
+} ltsaHeader_t;
+
+#pragma pack(pop)
+
+/* Estimator functions */
+
+void SPECTRUM_reset(spectrum_state_t *state) {
+
+	memset(state->power, 0, sizeof(state->power));
+	memset(state->powerCompensation, 0, sizeof(state->powerCompensation));
+	memset(state->band, 0, sizeof(state->band));
+
+#if SPECTRUM_INDICES
+	memset(state->scratch->differenceSum, 0,
+			sizeof(state->scratch->differenceSum));
+	memset(state->scratch->amplitudeSum, 0,
+			sizeof(state->scratch->amplitudeSum));
+	memset(state->scratch->amplitudeTotal, 0,
+			sizeof(state->scratch->amplitudeTotal));
+#endif
+
+#if SPECTRUM_TONES
+	memset(state->scratch->tonePower, 0,
+			sizeof(state->scratch->tonePower));
+	memset(state->scratch->tonePeriods, 0,
+			sizeof(state->scratch->tonePeriods));
+	memset(state->scratch->toneRatio, 0,
+			sizeof(state->scratch->toneRatio));
+#endif
+
+	state->fill = 0;
+	state->skip = 0;
+	state->numberOfFrames = 0;
+
+	state->framesInColumn = 0;
+	state->columnWriteIndex = 0;
+	state->columnReadIndex = 0;
+
+	state->framesInCluster = 0;
+	state->complexity = 0.0f;
+	state->envelopeSum = 0.0;
+	state->envelopeEntropySum = 0.0;
+
+	state->toneFill = 0;
+	state->toneFramesWritten = 0;
+	state->toneFramesRead = 0;
+	state->toneFramesDropped = 0;
+	state->framesInTonePeriod = 0;
+	state->numberOfTonePeriods = 0;
+}
+
+/* Periodic Hann window of a frame of the length at sample i, with the
+ * cosine taken from the twiddle factors of the first quarter of the turn */
+static inline float hann(const float (*twiddle)[2], uint32_t i,
+		uint32_t length) {
+
+	uint32_t j = i * (SPECTRUM_TWIDDLE_LENGTH / length);
+
+	j = MIN(j, SPECTRUM_TWIDDLE_LENGTH - j);
+
+	float c = j <= SPECTRUM_TWIDDLE_LENGTH / 4 ? twiddle[j][0] :
+			-twiddle[SPECTRUM_TWIDDLE_LENGTH / 2 - j][0];
+
+	return 0.5f - 0.5f * c;
+}
+
+void SPECTRUM_init(spectrum_state_t *state, spectrum_scratch_t *scratch,
+		float fs, float toneFs) {
+
+	state->scratch = scratch;
+	state->fs = fs;
+	state->toneFs = toneFs;
+
+	/* Half overlap, or frames spaced to keep SPECTRUM_MAX_FRAME_RATE */
+	state->hop = MAX(SPECTRUM_LENGTH / 2,
+			(uint32_t) (fs / SPECTRUM_MAX_FRAME_RATE));
+
+	/* Frames of a column of the long-term spectral average */
+	state->framesPerColumn = MAX(1,
+			lroundf(SPECTRUM_LTSA_DURATION * fs / (1000.0f * state->hop)));
+
+	/* Frames of a cluster of the acoustic complexity index */
+	state->framesPerCluster = MAX(2,
+			lroundf(SPECTRUM_ACI_DURATION * fs / (1000.0f * state->hop)));
+
+	/* Tone frames of a period of the tone detector, which do not overlap */
+	state->framesPerTonePeriod = MAX(1, lroundf(SPECTRUM_TONE_DURATION
+			* toneFs / (1000.0f * SPECTRUM_TONE_LENGTH)));
+
+	/* exp(-2 pi i k / SPECTRUM_TWIDDLE_LENGTH) for the first quarter of
+	 * the turn */
+	for (uint32_t k = 0; k <= SPECTRUM_TWIDDLE_LENGTH / 4; k += 1) {
+		double phi = 2.0 * PI * k / SPECTRUM_TWIDDLE_LENGTH;
+		scratch->twiddle[k][0] = (float) cos(phi);
+		scratch->twiddle[k][1] = (float) -sin(phi);
+	}
+
+	/* Power of the Hann window of the spectrum frames */
+	state->windowPower = 0.0f;
+
+	for (uint32_t i = 0; i < SPECTRUM_LENGTH; i += 1) {
+		float w = hann(scratch->twiddle, i, SPECTRUM_LENGTH);
+		state->windowPower += w * w;
+	}
+
+	SPECTRUM_reset(state);
+}
+
+/* In place complex FFT of n points, n a power of two up to
+ * SPECTRUM_TWIDDLE_LENGTH / 2, with radix-4 stages and a radix-2 stage first when
+ * n is not a power of four. After the bit reversal the four quarters of a
+ * radix-4 group hold the transforms of the inputs 0, 2, 1 and 3 modulo 4,
+ * so the group takes its inputs in that order. */
+static void fft(float *x, float (*twiddle)[2], uint32_t n) {
+
+	/* Bit reversal permutation */
+	for (uint32_t i = 1, j = 0; i < n; i += 1) {
+
+		uint32_t bit = n >> 1;
+
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+
+		j ^= bit;
+
+		if (i < j) {
+			float re = x[2 * i];
+			float im = x[2 * i + 1];
+			x[2 * i] = x[2 * j];
+			x[2 * i + 1] = x[2 * j + 1];
+			x[2 * j] = re;
+			x[2 * j + 1] = im;
+		}
+	}
+
+	uint32_t length = 1;
+
+	uint32_t log2n = 0;
+
+	while ((1u << log2n) < n) {
+		log2n += 1;
+	}
+
+	if (log2n & 1) {
+
+		for (uint32_t i = 0; i < 2 * n; i += 4) {
+			float re = x[i + 2];
+			float im = x[i + 3];
+			x[i + 2] = x[i] - re;
+			x[i + 3] = x[i + 1] - im;
+			x[i] += re;
+			x[i + 1] += im;
+		}
+
+		length = 2;
+	}
+
+	for (; length < n; length *= 4) {
+
+		/* exp(-2 pi i k / (4 length)) is twiddle[k * step] */
+		uint32_t step = SPECTRUM_TWIDDLE_LENGTH / (4 * length);
+
+		for (uint32_t k = 0; k < length; k += 1) {
+
+			float w1r = twiddle[k * step][0];
+			float w1i = twiddle[k * step][1];
+			float w2r = w1r * w1r - w1i * w1i;
+			float w2i = 2.0f * w1r * w1i;
+			float w3r = w2r * w1r - w2i * w1i;
+			float w3i = w2r * w1i + w2i * w1r;
+
+			for (uint32_t base = k; base < n; base += 4 * length) {
+
+				float *p0 = x + 2 * base;
+				float *p1 = p0 + 2 * length;
+				float *p2 = p1 + 2 * length;
+				float *p3 = p2 + 2 * length;
+
+				/* Inputs 1 and 2 modulo 4 are in the third and second
+				 * quarters */
+				float a0r = p0[0];
+				float a0i = p0[1];
+				float a1r = w1r * p2[0] - w1i * p2[1];
+				float a1i = w1r * p2[1] + w1i * p2[0];
+				float a2r = w2r * p1[0] - w2i * p1[1];
+				float a2i = w2r * p1[1] + w2i * p1[0];
+				float a3r = w3r * p3[0] - w3i * p3[1];
+				float a3i = w3r * p3[1] + w3i * p3[0];
+
+				float t0r = a0r + a2r;
+				float t0i = a0i + a2i;
+				float t1r = a0r - a2r;
+				float t1i = a0i - a2i;
+				float t2r = a1r + a3r;
+				float t2i = a1i + a3i;
+				float t3r = a1r - a3r;
+				float t3i = a1i - a3i;
+
+				p0[0] = t0r + t2r;
+				p0[1] = t0i + t2i;
+				p2[0] = t0r - t2r;
+				p2[1] = t0i - t2i;
+				p1[0] = t1r + t3i;
+				p1[1] = t1i - t3r;
+				p3[0] = t1r - t3i;
+				p3[1] = t1i + t3r;
+			}
+		}
+	}
+}
+
+/* Split the transform of a packed real frame of 2 m samples, Z, into the
+ * power of the bins k and m - k of the transform of the real frame,
+ * X[k] = E[k] + W^k O[k] with E and O the transforms of the even and odd
+ * samples and X[m - k] = conj(E[k] - W^k O[k]) */
+static inline void split(const float *x, const float (*twiddle)[2],
+		uint32_t m, uint32_t k, float *low, float *high) {
+
+	uint32_t j = m - k;
+
+	/* E[k] = (Z[k] + conj(Z[m - k])) / 2,
+	 * O[k] = -i (Z[k] - conj(Z[m - k])) / 2 */
+	float evenRe = 0.5f * (x[2 * k] + x[2 * j]);
+	float evenIm = 0.5f * (x[2 * k + 1] - x[2 * j + 1]);
+	float oddRe = 0.5f * (x[2 * k + 1] + x[2 * j + 1]);
+	float oddIm = -0.5f * (x[2 * k] - x[2 * j]);
+
+	uint32_t step = SPECTRUM_TWIDDLE_LENGTH / (2 * m);
+
+	float wr = twiddle[k * step][0];
+	float wi = twiddle[k * step][1];
+
+	float tr = wr * oddRe - wi * oddIm;
+	float ti = wr * oddIm + wi * oddRe;
+
+	float sumRe = evenRe + tr;
+	float sumIm = evenIm + ti;
+	float differenceRe = evenRe - tr;
+	float differenceIm = evenIm - ti;
+
+	*low = sumRe * sumRe + sumIm * sumIm;
+	*high = differenceRe * differenceRe + differenceIm * differenceIm;
+}
+
+/* Add the power of a bin to its running sum, to its band of the current
+ * column and to the sums of the indices. The compensation term keeps the
+ * error of the sum independent of the number of frames */
+static inline void accumulate(spectrum_state_t *state, uint32_t k,
+		float value) {
+
+	float y = value - state->powerCompensation[k];
+	float t = state->power[k] + y;
+	state->powerCompensation[k] = (t - state->power[k]) - y;
+	state->power[k] = t;
+
+	if (k < SPECTRUM_LENGTH / 2) {
+		state->band[k / SPECTRUM_LTSA_BINS_PER_BAND] += value;
+	}
+
+#if SPECTRUM_INDICES
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	/* Intensity differences of the acoustic complexity, inside a cluster */
+	float amplitude = sqrtf(value);
+
+	if (state->framesInCluster > 0) {
+		scratch->differenceSum[k] += fabsf(amplitude
+				- scratch->previousAmplitude[k]);
+	}
+
+	scratch->previousAmplitude[k] = amplitude;
+	scratch->amplitudeSum[k] += amplitude;
+	scratch->amplitudeTotal[k] += amplitude;
+
+	state->framePower += value;
+
+#endif
+
+}
+
+#if SPECTRUM_INDICES
+
+/* Add the complexity of the current cluster, the sum over the bins of
+ * the differences between consecutive frames relative to the sum of the
+ * amplitudes */
+static void update_cluster(spectrum_state_t *state) {
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	for (uint32_t k = 0; k < SPECTRUM_BINS; k += 1) {
+
+		if (scratch->amplitudeSum[k] > 0.0f) {
+			state->complexity += scratch->differenceSum[k]
+					/ scratch->amplitudeSum[k];
+		}
+
+		scratch->differenceSum[k] = 0.0f;
+		scratch->amplitudeSum[k] = 0.0f;
+	}
+
+	state->framesInCluster = 0;
+}
+
+#endif
+
+/* Store the levels of a completed column for the main loop */
+static void update_column(spectrum_state_t *state) {
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	uint32_t index = state->columnWriteIndex;
+
+	/* One-sided density of the band in full scale squared per Hz */
+	float scale = 2.0f / (SPECTRUM_LTSA_BINS_PER_BAND * state->framesPerColumn
+			* state->fs * state->windowPower * SPECTRUM_FULL_SCALE
+			* SPECTRUM_FULL_SCALE);
+
+	uint8_t *column = scratch->column[index % SPECTRUM_LTSA_BUFFER_LENGTH];
+
+	for (uint32_t i = 0; i < SPECTRUM_LTSA_BANDS; i += 1) {
+
+		float level = (10.0f * log10f(scale * state->band[i])
+				- SPECTRUM_LTSA_MIN_LEVEL) / SPECTRUM_LTSA_LEVEL_STEP;
+
+		column[i] = (uint8_t) lroundf(MAX(0.0f, MIN(UINT8_MAX, level)));
+
+		state->band[i] = 0.0f;
+	}
+
+	state->columnWriteIndex = index + 1;
+}
+
+#if SPECTRUM_TONES
+
+/* Find the tones of the completed period. The cumulative power, kept in
+ * the FFT buffer, gives the power of the critical band of each local
+ * maximum in constant time. */
+static void update_tones(spectrum_state_t *state) {
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	const float *power = scratch->tonePower;
+	float *cumulative = scratch->buffer;
+
+	cumulative[0] = 0.0f;
+
+	for (uint32_t k = 0; k < SPECTRUM_TONE_BINS; k += 1) {
+		cumulative[k + 1] = cumulative[k] + power[k];
+	}
+
+	float binWidth = state->toneFs / SPECTRUM_TONE_LENGTH;
+
+	uint32_t first = MAX(SPECTRUM_TONE_LOBE_BINS,
+			(uint32_t) ceilf(SPECTRUM_TONE_MIN_FREQUENCY / binWidth));
+	uint32_t last = MIN(SPECTRUM_TONE_BINS - 1 - SPECTRUM_TONE_LOBE_BINS,
+			(uint32_t) (SPECTRUM_TONE_MAX_FREQUENCY / binWidth));
+
+	for (uint32_t k = first; k <= last; k += 1) {
+
+		if (power[k] <= power[k - 1] || power[k] < power[k + 1]) {
+			continue;
+		}
+
+		/* Critical band around the peak */
+		float f = k * binWidth;
+		float bandwidth = f < 500.0f ? 100.0f : 0.2f * f;
+
+		int32_t low = lroundf((f - bandwidth / 2.0f) / binWidth);
+		int32_t high = lroundf((f + bandwidth / 2.0f) / binWidth);
+
+		low = MAX(0, low);
+		high = MIN(SPECTRUM_TONE_BINS - 1, high);
+
+		uint32_t bandBins = high - low + 1;
+		uint32_t lobeBins = 2 * SPECTRUM_TONE_LOBE_BINS + 1;
+
+		if (bandBins < lobeBins + SPECTRUM_TONE_MIN_NOISE_BINS) {
+			continue;
+		}
+
+		float lobe = cumulative[k + SPECTRUM_TONE_LOBE_BINS + 1]
+				- cumulative[k - SPECTRUM_TONE_LOBE_BINS];
+		float band = cumulative[high + 1] - cumulative[low];
+
+		/* Noise density outside the lobe, also under the tone */
+		float density = (band - lobe) / (bandBins - lobeBins);
+
+		float tone = lobe - lobeBins * density;
+		float noise = bandBins * density;
+
+		if (tone <= 0.0f || noise <= 0.0f) {
+			continue;
+		}
+
+		float ratio = 10.0f * log10f(tone / noise);
+
+		float criterion = 8.0f;
+
+		if (f < 1000.0f) {
+			criterion += 8.33f * log10f(1000.0f / f);
+		}
+
+		if (ratio >= criterion) {
+			scratch->tonePeriods[k] += 1;
+			scratch->toneRatio[k] = MAX(scratch->toneRatio[k], ratio);
+		}
+	}
+
+	memset(scratch->tonePower, 0, sizeof(scratch->tonePower));
+
+	state->framesInTonePeriod = 0;
+	state->numberOfTonePeriods += 1;
+}
+
+#endif
+
+/* Window the frame, transform it and add the squared magnitude of each
+ * bin to the sums */
+static void process_frame(spectrum_state_t *state) {
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	float *x = scratch->buffer;
+
+	for (uint32_t i = 0; i < SPECTRUM_LENGTH; i += 1) {
+		x[i] = hann(scratch->twiddle, i, SPECTRUM_LENGTH)
+				* (float) scratch->frame[i];
+	}
+
+	fft(x, scratch->twiddle, SPECTRUM_FFT_LENGTH);
+
+	state->framePower = 0.0f;
+
+	accumulate(state, 0, (x[0] + x[1]) * (x[0] + x[1]));
+	accumulate(state, SPECTRUM_FFT_LENGTH, (x[0] - x[1]) * (x[0] - x[1]));
+
+	for (uint32_t k = 1; k < SPECTRUM_FFT_LENGTH / 2; k += 1) {
+
+		float low, high;
+
+		split(x, scratch->twiddle, SPECTRUM_FFT_LENGTH, k, &low, &high);
+
+		accumulate(state, k, low);
+		accumulate(state, SPECTRUM_FFT_LENGTH - k, high);
+	}
+
+	/* At a quarter of the rate W^k = -i and X = conj(Z) */
+	uint32_t q = SPECTRUM_FFT_LENGTH / 2;
+
+	accumulate(state, q, x[2 * q] * x[2 * q] + x[2 * q + 1] * x[2 * q + 1]);
+
+	state->numberOfFrames += 1;
+
+#if SPECTRUM_INDICES
+
+	/* Envelope of the temporal entropy, the amplitude of the frame */
+	if (state->framePower > 0.0f) {
+		double envelope = sqrt(state->framePower);
+		state->envelopeSum += envelope;
+		state->envelopeEntropySum += envelope * log(envelope);
+	}
+
+	state->framesInCluster += 1;
+
+	if (state->framesInCluster == state->framesPerCluster) {
+		update_cluster(state);
+	}
+
+#endif
+
+	state->framesInColumn += 1;
+
+	if (state->framesInColumn == state->framesPerColumn) {
+		update_column(state);
+		state->framesInColumn = 0;
+	}
+}
+
+void SPECTRUM_process_block(spectrum_state_t *state, const int16_t *src,
+		uint32_t n) {
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	while (n > 0) {
+
+		/* Samples between two frames */
+		if (state->skip > 0) {
+			uint32_t m = MIN(state->skip, n);
+			state->skip -= m;
+			src += m;
+			n -= m;
+			continue;
+		}
+
+		uint32_t m = MIN(SPECTRUM_LENGTH - state->fill, n);
+
+		memcpy(scratch->frame + state->fill, src, m * sizeof(int16_t));
+
+		state->fill += m;
+		src += m;
+		n -= m;
+
+		if (state->fill == SPECTRUM_LENGTH) {
+
+			process_frame(state);
+
+			/* Keep the overlap with the next frame */
+			if (state->hop < SPECTRUM_LENGTH) {
+				state->fill = SPECTRUM_LENGTH - state->hop;
+				memmove(scratch->frame, scratch->frame + state->hop,
+						state->fill * sizeof(int16_t));
+			} else {
+				state->fill = 0;
+				state->skip = state->hop - SPECTRUM_LENGTH;
+			}
+		}
+	}
+}
+
+/* Add samples to the tone frame being filled */
+void SPECTRUM_add_tone_samples(spectrum_state_t *state, const int16_t *src,
+		uint32_t n) {
+
+#if SPECTRUM_TONES
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	while (n > 0) {
+
+		uint32_t m = MIN(SPECTRUM_TONE_LENGTH - state->toneFill, n);
+
+		memcpy(scratch->toneFrame[state->toneFramesWritten % 2]
+				+ state->toneFill, src, m * sizeof(int16_t));
+
+		state->toneFill += m;
+		src += m;
+		n -= m;
+
+		if (state->toneFill == SPECTRUM_TONE_LENGTH) {
+
+			state->toneFill = 0;
+
+			/* Hand the frame to the main loop, or fill it again if the
+			 * main loop still has the other one */
+			if (state->toneFramesRead == state->toneFramesWritten) {
+				state->toneFramesWritten += 1;
+			} else {
+				state->toneFramesDropped += 1;
+			}
+		}
+	}
+
+#else
+
+	(void) state;
+	(void) src;
+	(void) n;
+
+#endif
+
+}
+
+/* Window the completed tone frame, transform it and add the squared
+ * magnitude of each bin to the tone period */
+void SPECTRUM_process_tones(spectrum_state_t *state) {
+
+#if SPECTRUM_TONES
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	if (state->toneFramesRead == state->toneFramesWritten) {
+		return;
+	}
+
+	const int16_t *frame = scratch->toneFrame[state->toneFramesRead % 2];
+
+	/* The samples of the SPL pipeline keep the offset of the microphone,
+	 * which would leak into the lowest bins */
+	int32_t sum = 0;
+
+	for (uint32_t i = 0; i < SPECTRUM_TONE_LENGTH; i += 1) {
+		sum += frame[i];
+	}
+
+	float mean = (float) sum / SPECTRUM_TONE_LENGTH;
+
+	float *x = scratch->buffer;
+
+	for (uint32_t i = 0; i < SPECTRUM_TONE_LENGTH; i += 1) {
+		x[i] = hann(scratch->twiddle, i, SPECTRUM_TONE_LENGTH)
+				* ((float) frame[i] - mean);
+	}
+
+	/* The frame can be filled again */
+	state->toneFramesRead += 1;
+
+	uint32_t m = SPECTRUM_TONE_LENGTH / 2;
+
+	fft(x, scratch->twiddle, m);
+
+	float *power = scratch->tonePower;
+
+	power[0] += (x[0] + x[1]) * (x[0] + x[1]);
+	power[m] += (x[0] - x[1]) * (x[0] - x[1]);
+
+	for (uint32_t k = 1; k < m / 2; k += 1) {
+
+		float low, high;
+
+		split(x, scratch->twiddle, m, k, &low, &high);
+
+		power[k] += low;
+		power[m - k] += high;
+	}
+
+	/* At a quarter of the rate W^k = -i and X = conj(Z) */
+	uint32_t q = m / 2;
+
+	power[q] += x[2 * q] * x[2 * q] + x[2 * q + 1] * x[2 * q + 1];
+
+	state->framesInTonePeriod += 1;
+
+	if (state->framesInTonePeriod == state->framesPerTonePeriod) {
+		update_tones(state);
+	}
+
+#else
+
+	(void) state;
+
+#endif
+
+}
+
+#if SPECTRUM_INDICES
+
+/* Sum of the power of the bins from the minimum to the maximum frequency */
+static float band_power(spectrum_state_t *state, float minimum,
+		float maximum) {
+
+	float binWidth = state->fs / SPECTRUM_LENGTH;
+
+	float power = 0.0f;
+
+	for (uint32_t k = 0; k < SPECTRUM_BINS; k += 1) {
+		if (k * binWidth >= minimum && k * binWidth < maximum) {
+			power += state->power[k];
+		}
+	}
+
+	return power;
+}
+
+/* Entropy of n values normalised to sum one, -sum(p ln p) / ln(n), from
+ * the sum of the values and the sum of x ln x */
+static float normalised_entropy(double sum, double entropySum, uint32_t n) {
+
+	if (sum <= 0.0 || n < 2) {
+		return 0.0f;
+	}
+
+	return (float) ((log(sum) - entropySum / sum) / log((double) n));
+}
+
+#endif
+
+/* Compute the ecoacoustic indices */
+void SPECTRUM_to_indices(spectrum_state_t *state) {
+
+#if SPECTRUM_INDICES
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	/* Acoustic complexity with the last cluster if it has two frames */
+	if (state->framesInCluster > 1) {
+		update_cluster(state);
+	}
+
+	state->indices[SPECTRUM_INDEX_ACI] = state->complexity;
+
+	/* Normalised difference of the biophony and the anthrophony */
+	float anthrophony = band_power(state, SPECTRUM_ANTHROPHONY_MIN_FREQUENCY,
+			SPECTRUM_ANTHROPHONY_MAX_FREQUENCY);
+	float biophony = band_power(state, SPECTRUM_BIOPHONY_MIN_FREQUENCY,
+			SPECTRUM_BIOPHONY_MAX_FREQUENCY);
+
+	state->indices[SPECTRUM_INDEX_NDSI] = 0.0f;
+
+	if (anthrophony + biophony > 0.0f) {
+		state->indices[SPECTRUM_INDEX_NDSI] = (biophony - anthrophony)
+				/ (biophony + anthrophony);
+	}
+
+	/* Area of the mean spectrum in dB above its minimum in the band */
+	float binWidth = state->fs / SPECTRUM_LENGTH;
+
+	float minimum = INFINITY;
+	float sum = 0.0f;
+	uint32_t n = 0;
+
+	for (uint32_t k = 0; k < SPECTRUM_BINS; k += 1) {
+		if (k * binWidth >= SPECTRUM_BI_MIN_FREQUENCY
+				&& k * binWidth < SPECTRUM_BI_MAX_FREQUENCY
+				&& state->power[k] > 0.0f) {
+			float level = 10.0f * log10f(state->power[k]);
+			minimum = MIN(minimum, level);
+			sum += level;
+			n += 1;
+		}
+	}
+
+	state->indices[SPECTRUM_INDEX_BI] = 0.0f;
+
+	if (n > 0) {
+		state->indices[SPECTRUM_INDEX_BI] = (sum - n * minimum) * binWidth
+				/ 1000.0f;
+	}
+
+	/* Spectral entropy of the mean amplitude spectrum */
+	double amplitudeSum = 0.0;
+	double amplitudeEntropySum = 0.0;
+
+	for (uint32_t k = 0; k < SPECTRUM_BINS; k += 1) {
+		double amplitude = scratch->amplitudeTotal[k];
+		if (amplitude > 0.0) {
+			amplitudeSum += amplitude;
+			amplitudeEntropySum += amplitude * log(amplitude);
+		}
+	}
+
+	state->indices[SPECTRUM_INDEX_HF] = normalised_entropy(amplitudeSum,
+			amplitudeEntropySum, SPECTRUM_BINS);
+
+	/* Temporal entropy of the frame envelope */
+	state->indices[SPECTRUM_INDEX_HT] = normalised_entropy(state->envelopeSum,
+			state->envelopeEntropySum, state->numberOfFrames);
+
+#else
+
+	(void) state;
+
+#endif
+
+}
+
+/* Append the longest tonal components to the tone log */
+bool SPECTRUM_write_tones(spectrum_state_t *state, uint32_t currentTime) {
+
+#if SPECTRUM_TONES
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	float binWidth = state->toneFs / SPECTRUM_TONE_LENGTH;
+
+	float periodDuration = (float) (state->framesPerTonePeriod
+			* SPECTRUM_TONE_LENGTH) / state->toneFs;
+
+	/* Components of adjacent bins, the frequency of the bin with the most
+	 * periods and the largest ratio */
+	uint32_t frequency[SPECTRUM_MAX_TONES];
+	float ratio[SPECTRUM_MAX_TONES];
+	uint32_t periods[SPECTRUM_MAX_TONES];
+
+	uint32_t numberOfTones = 0;
+
+	uint32_t k = 0;
+
+	while (k < SPECTRUM_TONE_BINS) {
+
+		if (scratch->tonePeriods[k] == 0) {
+			k += 1;
+			continue;
+		}
+
+		uint32_t peak = k;
+		uint32_t sum = 0;
+		float largest = 0.0f;
+
+		while (k < SPECTRUM_TONE_BINS && scratch->tonePeriods[k] > 0) {
+			if (scratch->tonePeriods[k] > scratch->tonePeriods[peak]) {
+				peak = k;
+			}
+			sum += scratch->tonePeriods[k];
+			largest = MAX(largest, scratch->toneRatio[k]);
+			k += 1;
+		}
+
+		/* Keep the longest, replacing the shortest kept */
+		uint32_t index = numberOfTones;
+
+		if (numberOfTones == SPECTRUM_MAX_TONES) {
+			index = 0;
+			for (uint32_t i = 1; i < SPECTRUM_MAX_TONES; i += 1) {
+				if (periods[i] < periods[index]) {
+					index = i;
+				}
+			}
+			if (periods[index] >= sum) {
+				continue;
+			}
+		} else {
+			numberOfTones += 1;
+		}
+
+		frequency[index] = lroundf(peak * binWidth);
+		ratio[index] = largest;
+		periods[index] = sum;
+	}
+
+	AudioMoth_enableFileSystem();
+
+	if (!AudioMoth_appendFile(toneFilename)) {
+		return false;
+	}
+
+	char buffer[LOG_BUFFER_LENGTH];
+
+	time_t rawtime = currentTime;
+
+	struct tm *time = gmtime(&rawtime);
+
+	sprintf(buffer, "%02d/%02d/%04d %02d:%02d:%02d: ", time->tm_mday,
+			time->tm_mon + 1, time->tm_year + 1900, time->tm_hour, time->tm_min,
+			time->tm_sec);
+
+	bool success = AudioMoth_writeToFile(buffer,
+			strnlen(buffer, LOG_BUFFER_LENGTH));
+
+	/* Analysed time and tone frames the main loop did not read in time */
+	float_to_string(buffer, state->numberOfTonePeriods * periodDuration);
+	success &= AudioMoth_writeToFile(buffer,
+			strnlen(buffer, LOG_BUFFER_LENGTH));
+
+	sprintf(buffer, "%lu ", (unsigned long) state->toneFramesDropped);
+	success &= AudioMoth_writeToFile(buffer,
+			strnlen(buffer, LOG_BUFFER_LENGTH));
+
+	/* From the longest */
+	while (numberOfTones > 0) {
+
+		uint32_t index = 0;
+
+		for (uint32_t i = 1; i < numberOfTones; i += 1) {
+			if (periods[i] > periods[index]) {
+				index = i;
+			}
+		}
+
+		sprintf(buffer, "%lu ", (unsigned long) frequency[index]);
+		success &= AudioMoth_writeToFile(buffer,
+				strnlen(buffer, LOG_BUFFER_LENGTH));
+
+		float_to_string(buffer, ratio[index]);
+		success &= AudioMoth_writeToFile(buffer,
+				strnlen(buffer, LOG_BUFFER_LENGTH));
+
+		float_to_string(buffer, periods[index] * periodDuration);
+		success &= AudioMoth_writeToFile(buffer,
+				strnlen(buffer, LOG_BUFFER_LENGTH));
+
+		numberOfTones -= 1;
+
+		frequency[index] = frequency[numberOfTones];
+		ratio[index] = ratio[numberOfTones];
+		periods[index] = periods[numberOfTones];
+	}
+
+	success &= AudioMoth_writeToFile("\n", 1);
+
+	return AudioMoth_closeFile() && success;
+
+#else
+
+	(void) state;
+	(void) currentTime;
+
+	return true;
+
+#endif
+
+}
+
+/* Save the spectrum */
+bool SPECTRUM_write_file(spectrum_state_t *state, char *filename,
+		uint32_t currentTime) {
+
+	spectrum_scratch_t *scratch = state->scratch;
+
+	/* One-sided density in full scale squared per Hz, the bins between DC
+	 * and the Nyquist frequency count twice */
+	float scale = 0.0f;
+
+	if (state->numberOfFrames > 0) {
+		scale = 1.0f / (state->numberOfFrames * state->fs * state->windowPower
+				* SPECTRUM_FULL_SCALE * SPECTRUM_FULL_SCALE);
+	}
+
+	for (uint32_t k = 0; k < SPECTRUM_BINS; k += 1) {
+
+		float density = scale * state->power[k];
+
+		if (k > 0 && k < SPECTRUM_BINS - 1) {
+			density *= 2.0f;
+		}
+
+		float level = 1000.0f * log10f(density);
+
+		level = MAX(INT16_MIN, MIN(INT16_MAX, level));
+
+		scratch->level[k] = (int16_t) lroundf(level);
+	}
+
+	spectrumHeader_t header = { .id = "SPLS", .time = currentTime,
+			.sampleRate = (uint32_t) state->fs, .frameLength = SPECTRUM_LENGTH,
+			.numberOfFrames = state->numberOfFrames,
+			.numberOfBins = SPECTRUM_BINS };
+
+	if (!AudioMoth_openFile(filename)) {
+		return false;
+	}
+
+	bool success = AudioMoth_writeToFile(&header, sizeof(spectrumHeader_t))
+			&& AudioMoth_writeToFile(scratch->level,
+					SPECTRUM_BINS * sizeof(int16_t));
+
+	return AudioMoth_closeFile() && success;
+}
+
+/* Open the long-term spectral average file */
+bool SPECTRUM_open_ltsa_file(spectrum_state_t *state, char *filename,
+		uint32_t currentTime) {
+
+	ltsaHeader_t header = { .id = "SPLT", .time = currentTime,
+			.sampleRate = (uint32_t) state->fs, .hop = state->hop,
+			.framesPerColumn = state->framesPerColumn,
+			.numberOfBands = SPECTRUM_LTSA_BANDS,
+			.minimumLevel = (int16_t) (100.0f * SPECTRUM_LTSA_MIN_LEVEL),
+			.levelStep = (uint16_t) (100.0f * SPECTRUM_LTSA_LEVEL_STEP) };
+
+	if (!AudioMoth_openAuxiliaryFile(SPECTRUM_LTSA_FILE, filename)) {
+		return false;
+	}
+
+	return AudioMoth_writeToAuxiliaryFile(SPECTRUM_LTSA_FILE, &header,
+			sizeof(ltsaHeader_t));
+}
+
+/* Write the columns completed since the last call */
+bool SPECTRUM_write_ltsa(spectrum_state_t *state) {
+
+	uint32_t readIndex = state->columnReadIndex;
+	uint32_t writeIndex = state->columnWriteIndex;
+
+	while (readIndex != writeIndex) {
+
+		/* Contiguous part of the ring buffer */
+		uint32_t start = readIndex % SPECTRUM_LTSA_BUFFER_LENGTH;
+		uint32_t length = MIN(writeIndex - readIndex,
+				SPECTRUM_LTSA_BUFFER_LENGTH - start);
+
+		if (!AudioMoth_writeToAuxiliaryFile(SPECTRUM_LTSA_FILE,
+				state->scratch->column[start],
+				length * SPECTRUM_LTSA_BANDS)) {
+			return false;
+		}
+
+		readIndex += length;
+		state->columnReadIndex = readIndex;
+	}
+
+	return true;
+}
+
+/* Close the long-term spectral average file */
+bool SPECTRUM_close_ltsa_file(spectrum_state_t *state) {
+
+	bool success = SPECTRUM_write_ltsa(state);
+
+	return AudioMoth_closeAuxiliaryFile(SPECTRUM_LTSA_FILE) && success;
+}
@@ -14,202 +14,1459 @@
 #include "spl.h"
 #include "audioMoth.h"
 
-/* Temp variables of dbA filter */
-static float fRec0[3], fRec1[2], fRec2[2], fRec3[3];
+/* file name and buffer for SD memory */
+static char logFilename[20];
+static char rollupFilename[] = "LDEN.log";
+static char exposureFilename[] = "DOSE.log";
+static char logBuffer[LOG_BUFFER_LENGTH];
 
-/* dbA filter coefficients */
-static float a1[2], b1[3], a2, b2[2], a3, b3[2], a4[2], b4[3];
+/* A-weighting pole frequencies in rad/s */
+#define SPL_W(f)                            (2.0 * 3.141592653589793 * (f))
+#define SPL_W1                              SPL_W(20.6)
+#define SPL_W2                              SPL_W(107.7)
+#define SPL_W3                              SPL_W(737.9)
+#define SPL_W4                              SPL_W(12194.0)
 
-/* dbA filter cut frequencies */
-static float w1, w2, w3, w4;
+/* Bilinear transform of the low frequency sections of the A-weighting,
+ * s^2 / (s + w)^2 and s / (s + w), with the poles written as their
+ * distance to z = 1. Written as constant expressions so that the compiler
+ * evaluates the table below at build time. The gain of the double pole
+ * section is the square of SPL_POLE_B0. */
+#define SPL_POLE_B0(w, fs)                  (2.0 * (fs) / ((w) + 2.0 * (fs)))
+#define SPL_POLE_DELTA(w, fs)               (2.0 * (w) / ((w) + 2.0 * (fs)))
 
-/* global variables of SPL and number of samples */
-float spl;
-uint32_t n;
+#define SPL_A_WEIGHTING_COEFFICIENTS(fs) { (fs), \
+	{ SPL_POLE_B0(SPL_W1, fs), SPL_POLE_B0(SPL_W2, fs), \
+	  SPL_POLE_B0(SPL_W3, fs) }, \
+	{ SPL_POLE_DELTA(SPL_W1, fs), SPL_POLE_DELTA(SPL_W2, fs), \
+	  SPL_POLE_DELTA(SPL_W3, fs) } }
 
-/* file name and buffer for SD memory */
-static char logFilename[20];
-static char logBuffer[LOG_BUFFER_LENGTH];
+/* A-weighting filter coefficients for a sampling rate */
+typedef struct {
+	float fs;
+	float b0[3];
+	float delta[3];
+} A_weighting_coefficients_t;
+
+/* Matched second order section of the high frequency double pole of the
+ * A-weighting, w4^2 / (s + w4)^2 */
+typedef struct {
+	double a[2];
+	double b[3];
+	double delta;
+} high_frequency_section_t;
+
+/* Sampling rates produced by sampleRate / sampleRateDivider */
+static const A_weighting_coefficients_t A_weighting_table[] = {
+	SPL_A_WEIGHTING_COEFFICIENTS(8000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(16000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(24000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(32000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(48000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(96000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(125000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(192000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(250000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(256000.0),
+	SPL_A_WEIGHTING_COEFFICIENTS(384000.0)
+};
+
+/* Compensation filter, see notebooks/Mic_compensation_filter.ipynb. Two
+ * equal sections with the zero and the pole at the radii of these analog
+ * frequencies (matched z-transform), the radii of the notebook at 48 kHz
+ * (0.993 and 0.999). The response is about +2 dB at 100 Hz and the gain is
+ * normalised at the reference frequency. */
+#define SPL_COMPENSATION_ZERO_FREQUENCY     53.6
+#define SPL_COMPENSATION_POLE_FREQUENCY     7.64
+#define SPL_COMPENSATION_REFERENCE_FREQUENCY 1000.0
+
+#define ARRAY_LENGTH(a)                     (sizeof(a) / sizeof((a)[0]))
+
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+/* Header of the short interval Leq file */
+
+#pragma pack(push, 1)
+
+typedef struct {
+	char id[4];
+	uint32_t time;
+	uint32_t sampleRate;
+	uint32_t intervalDuration;
+} intervalHeader_t;
+
+#pragma pack(pop)
 
-/* Offset of the SPL measure (found in calibration) */
-float cal_offset;
+/* Default calibration offsets of the gain settings and offsets of the
+ * device, with the gains measured with the calibrator */
+static const float defaultOffsets[SPL_NUMBER_OF_GAINS] = { CALdBA_low,
+		CALdBA_low_med, CALdBA_med, CALdBA_med_high, CALdBA_high };
 
-/* Temp variables of microphone compensation filter */
-float fRec0_comp[2];
-float fRec1_comp[2];
+static float calibrationOffsets[SPL_NUMBER_OF_GAINS] = { CALdBA_low,
+		CALdBA_low_med, CALdBA_med, CALdBA_med_high, CALdBA_high };
+
+static bool calibrated[SPL_NUMBER_OF_GAINS];
+
+/* Update the energy scales from the gains of the filters */
+static void update_energy_scale(spl_state_t *state) {
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	float gains[] = { state->G_A_q31, state->G_C_q31, 1.0f };
+	float normalization = SPL_INPUT_NORMALIZATION
+			* (float) (1 << SPL_Q31_INPUT_SHIFT);
+#else
+	float gains[] = { state->G_A, state->G_C, state->G_Z };
+	float normalization = SPL_INPUT_NORMALIZATION;
+#endif
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_WEIGHTINGS; i += 1) {
+		float gain = state->G_comp * gains[i] / normalization;
+		state->energyScale[i] = gain * gain;
+	}
+}
+
+/* Convert a mean square value to dB. Every weighting is 0 dB at 1 kHz,
+ * so the calibration offset, the sensitivity of the microphone at 1 kHz,
+ * is the same for all of them. */
+static float to_dB(spl_state_t *state, uint32_t weighting, float value) {
+	return 10.0f * log10f(state->energyScale[weighting] * value)
+			+ state->cal_offset;
+}
+
+/* Level of the square of the 16 bit full scale at 1 kHz. The energy
+ * scales undo the internal scale of each engine, so every engine reads
+ * an input of mean square x at 1 kHz as x / SPL_INPUT_NORMALIZATION^2. */
+static float full_scale_dB(spl_state_t *state) {
+	return 20.0f * log10f(SPL_TRUE_PEAK_FULL_SCALE / SPL_INPUT_NORMALIZATION)
+			+ state->cal_offset;
+}
+
+#if SPL_ENGINE == SPL_ENGINE_Q31
+
+/* Convert a coefficient to Q30 */
+static int32_t to_q30(float value) {
+	return (int32_t) lroundf(value * (float) (1 << SPL_Q31_COEFFICIENT_SHIFT));
+}
+
+/* Q30 feedback coefficient of a real pole at 1 - delta. Working with the
+ * distance to z = 1 keeps the precision of poles close to the unit circle,
+ * which a float coefficient near 1 would lose. */
+static int32_t to_q30_pole(float delta) {
+	return to_q30(delta) - (1 << SPL_Q31_COEFFICIENT_SHIFT);
+}
+
+/* Q30 feedback coefficients of a double real pole at 1 - delta */
+static void to_q30_double_pole(int32_t *a, float delta) {
+	int64_t one = (int64_t) 1 << SPL_Q31_COEFFICIENT_SHIFT;
+	a[0] = (int32_t) (2 * (to_q30(delta) - one));
+	a[1] = (int32_t) (one - to_q30(2.0f * delta - delta * delta));
+}
 
-/* Coefficients of the compensation filter */
-float a_comp;
-float b_comp;
-float G_comp;
+#endif
 
-void float_to_string(char* string, float value);
+#if SPL_TRUE_PEAK
+
+/* Design the polyphase filter of the true peak. Phase p interpolates
+ * between the samples, p / SPL_TRUE_PEAK_OVERSAMPLING after the centre of
+ * the taps, with a Hann windowed sinc normalised to unit gain at DC. */
+static void init_true_peak(spl_state_t *state) {
+
+	const float centre = SPL_TRUE_PEAK_TAPS / 2;
+
+	for (uint32_t p = 1; p < SPL_TRUE_PEAK_OVERSAMPLING; p += 1) {
+
+		float *taps = state->truePeakTaps[p - 1];
+		float sum = 0.0f;
+
+		for (uint32_t j = 0; j < SPL_TRUE_PEAK_TAPS; j += 1) {
+			float u = j - centre + (float) p / SPL_TRUE_PEAK_OVERSAMPLING;
+			float window = 0.5f + 0.5f * cosf(PI * u / centre);
+			taps[j] = window * sinf(PI * u) / (PI * u);
+			sum += taps[j];
+		}
+
+		for (uint32_t j = 0; j < SPL_TRUE_PEAK_TAPS; j += 1) {
+			taps[j] /= sum;
+		}
+	}
+}
+
+#endif
+
+/* Squared magnitude of a real pole at 1 - delta, with p = sin^2(w / 2) */
+static double pole_power(double delta, double p) {
+	return 1.0 / (delta * delta + 4.0 * (1.0 - delta) * p);
+}
+
+/* Squared magnitude of b[0] + b[1] z^-1 + b[2] z^-2 at the angular
+ * frequency w */
+static double numerator_power(const double *b, double w) {
+	double re = b[0] + b[1] * cos(w) + b[2] * cos(2.0 * w);
+	double im = b[1] * sin(w) + b[2] * sin(2.0 * w);
+	return re * re + im * im;
+}
+
+/* Design the high frequency section. The bilinear transform maps w4 to
+ * the Nyquist frequency, so at low sampling rates its zeros at z = -1 fall
+ * inside the audio band. Instead the double pole is placed at exp(-w4 / fs)
+ * and the numerator matches the analog magnitude at DC, at fs / 4 and at
+ * the Nyquist frequency (matched magnitude design). */
+static void design_high_frequency_section(high_frequency_section_t *section,
+		float fs) {
+
+	double w4 = SPL_W4;
+
+	double delta = -expm1(-w4 / fs);
+	double r = 1.0 - delta;
+
+	section->delta = delta;
+	section->a[0] = -2.0 * r;
+	section->a[1] = r * r;
+
+	/* |B|^2 = B0 (1 - p) + B1 p + B2 4 p (1 - p) with p = sin^2(w / 2), the
+	 * same for the denominator, A0 = (1 - r)^4, A1 = (1 + r)^4, A2 = -4 r^2 */
+	double A0 = delta * delta * delta * delta;
+	double A1 = (1.0 + r) * (1.0 + r) * (1.0 + r) * (1.0 + r);
+	double A2 = -4.0 * r * r;
+
+	double wn = PI * fs;
+	double wm = 0.5 * PI * fs;
+
+	double hn = w4 * w4 / (wn * wn + w4 * w4);
+	double hm = w4 * w4 / (wm * wm + w4 * w4);
+
+	double B0 = A0;
+	double B1 = A1 * hn * hn;
+	double B2 = (0.5 * (A0 + A1) + A2) * hm * hm - 0.5 * (B0 + B1);
+
+	double W = 0.5 * (sqrt(B0) + sqrt(B1));
+
+	section->b[0] = 0.5 * (W + sqrt(W * W + B2));
+	section->b[1] = 0.5 * (sqrt(B0) - sqrt(B1));
+	section->b[2] = -B2 / (4.0 * section->b[0]);
+}
 
 /* Reset Compensation filter */
-void SPL_reset_compensation_filter() {
-	for (int ix = 0; (ix < 2); ix = (ix + 1)) {
-		fRec0_comp[ix] = 0.0f;
-		fRec1_comp[ix] = 0.0f;
+void SPL_reset_compensation_filter(spl_state_t *state) {
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	state->q_x1 = 0;
+	state->q_c1 = 0;
+	state->q_rc = 0;
+	state->q_rd = 0;
+#endif
+#if SPL_ENGINE != SPL_ENGINE_Q31
+	for (int l0 = 0; (l0 < 2); l0 = (l0 + 1)) {
+		state->d_y[l0] = 0.0f;
+		state->d_e[l0] = 0.0f;
 	}
+	state->d_x1 = 0.0f;
+#endif
 }
 
 /* Init Compensation filter */
-void SPL_init_compensation_filter(float fs) {
-	SPL_reset_compensation_filter();
-
-	if (fs == 8000) {
-		a_comp = -0.97;
-		b_comp = -0.948;
-		G_comp = 1.0198586881755944;
-	} else if (fs == 16000) {
-		a_comp = -0.98;
-		b_comp = -0.97;
-		G_comp = 1.0068852990025103;
-	} else if (fs == 32000) {
-		a_comp = -0.998;
-		b_comp = -0.9895;
-		G_comp = 1.005779339050867;
-	} else if (fs == 48000) {
-		a_comp = -0.999;
-		b_comp = -0.993;
-		G_comp = 1.0033250259620856;
-	} else if (fs == 96000) {
-		a_comp = -0.999;
-		b_comp = -0.9964;
-		G_comp = 1.0;
-	} else if (fs == 192000) {
-		a_comp = -0.9995;
-		b_comp = -0.9979;
-		G_comp = 0.9992823605244088;
-	} else if (fs == 256000) {
-		a_comp = -0.9995;
-		b_comp = -0.9985;
-		G_comp = 0.9992823605244088;
-	} else if (fs == 192000) {
-		a_comp = -0.9995;
-		b_comp = -0.9979;
-		G_comp = 0.998417420445598;
-	} else if (fs == 384000) {
-		a_comp = -0.9996;
-		b_comp = -0.99895;
-		G_comp = 0.9981619947924345;
-	}
-
-}
-
-float SPL_compensation_mic_filter_step(float sample) {
-	float filtered_sample;
-	fRec1_comp[0] = (sample - (a_comp * fRec1_comp[1]));
-	fRec0_comp[0] = ((fRec1_comp[0] + (b_comp * fRec1_comp[1]))
-			- (a_comp * fRec0_comp[1]));
-	filtered_sample = (float) (G_comp
-			* (fRec0_comp[0] + (b_comp * fRec0_comp[1])));
-	fRec1_comp[1] = fRec1_comp[0];
-	fRec0_comp[1] = fRec0_comp[0];
-	return filtered_sample;
+void SPL_init_compensation_filter(spl_state_t *state, float fs) {
+	SPL_reset_compensation_filter(state);
+
+	/* Distances of the zero and the pole to z = 1, 1 - exp(-2 pi f / fs),
+	 * without the cancellation of 1 - r at high rates */
+	double beta = -expm1(-2.0 * PI * SPL_COMPENSATION_ZERO_FREQUENCY / fs);
+	double alpha = -expm1(-2.0 * PI * SPL_COMPENSATION_POLE_FREQUENCY / fs);
+
+	state->a_comp = (float) (alpha - 1.0);
+	state->b_comp = (float) (beta - 1.0);
+
+	/* |1 - r exp(-jw)|^2 = (1 - r)^2 + 4 r sin^2(w / 2) for each section,
+	 * the two sections give the square of the amplitude ratio */
+	double s = sin(PI * SPL_COMPENSATION_REFERENCE_FREQUENCY / fs);
+	double num = beta * beta + 4.0 * (1.0 - beta) * s * s;
+	double den = alpha * alpha + 4.0 * (1.0 - alpha) * s * s;
+
+	state->G_comp = (float) (den / num);
+
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	state->q_a_comp = to_q30(state->a_comp);
+	state->q_b_comp = to_q30(state->b_comp);
+#endif
+#if SPL_ENGINE != SPL_ENGINE_Q31
+	state->d_beta_comp = (float) beta;
+	state->d_alpha_comp = (float) alpha;
+#endif
+
+	update_energy_scale(state);
+}
+
+/* Length of the next detector period, one sample more each time the
+ * remainders of the rate add up to a whole period */
+static uint32_t next_detector_period(spl_state_t *state) {
+
+	state->detectorPhase += state->detectorRemainder;
+
+	if (state->detectorPhase >= SPL_DETECTOR_RATE) {
+		state->detectorPhase -= SPL_DETECTOR_RATE;
+		return state->detectorPeriod + 1;
+	}
+
+	return state->detectorPeriod;
 }
 
 /* Reset A-weighing filter */
-void SPL_reset_A_weighting_filter() {
-	spl = 0.0f;
-	n = 0;
+void SPL_reset_A_weighting_filter(spl_state_t *state) {
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_WEIGHTINGS; i += 1) {
+		state->energy[i] = 0.0;
+		state->energyCompensation[i] = 0.0;
+	}
+	state->n = 0;
+	state->spl = 0.0f;
+	state->LCeq = 0.0f;
+	state->LZeq = 0.0f;
+
+	state->detectorPhase = 0;
+	state->detectorLength = next_detector_period(state);
+	state->detectorCountdown = state->detectorLength;
+	state->detectorSettling = state->detectorSettlingPeriods;
+	state->detectorSum = 0.0f;
+	state->fast = 0.0f;
+	state->slow = 0.0f;
+	state->impulse = 0.0f;
+	state->fastMax = 0.0f;
+	state->fastMin = 0.0f;
+	state->slowMax = 0.0f;
+	state->impulseMax = 0.0f;
 
-	for (int l0 = 0; (l0 < 3); l0 = (l0 + 1)) {
-		fRec0[l0] = 0.0f;
-		fRec3[l0] = 0.0f;
+	state->intervalCountdown = state->intervalPeriods;
+	state->intervalSamples = 0;
+	state->intervalSum = 0.0f;
+	state->intervalWriteIndex = 0;
+	state->intervalReadIndex = 0;
+	state->intervalsDropped = 0;
+
+	state->detectorPeriods = 0;
+	state->detectorSamples = 0;
+	state->eventActive = false;
+	state->eventWriteIndex = 0;
+	state->eventReadIndex = 0;
+	state->eventsDropped = 0;
+
+	state->samplesCounted = 0;
+	state->samplesSaturated = 0;
+	state->samplesNearFullScale = 0;
+	state->samplesUnderRange = 0;
+	state->samplesClipped = 0;
+	state->samplePeak = 0;
+	state->overloadBurst = 0;
+	state->longestOverloadBurst = 0;
+
+	state->peakC = 0.0f;
+#if SPL_TRUE_PEAK
+	state->truePeak = 0.0f;
+	memset(state->truePeakHistory, 0, sizeof(state->truePeakHistory));
+#endif
+#if SPL_CALIBRATION
+	state->goertzelCount = 0;
+	state->goertzelS1 = 0.0f;
+	state->goertzelS2 = 0.0f;
+	state->goertzelSum = 0.0f;
+	state->goertzelSumSquares = 0.0f;
+	state->toneEnergy = 0.0f;
+	state->signalEnergy = 0.0f;
+#endif
+
+	state->histogramCountdown = state->histogramPeriods;
+	state->histogramSamples = 0;
+	state->histogramSum = 0.0f;
+	state->histogramCount = 0;
+	memset(state->scratch->histogram, 0,
+			sizeof(state->scratch->histogram));
+	state->doseSum = 0.0f;
+
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	for (int l0 = 0; (l0 < 2); l0 = (l0 + 1)) {
+		state->q_d[l0] = 0;
+		state->q_e[l0] = 0;
+		state->q_f[l0] = 0;
+		state->q_r[l0] = 0;
 	}
-	for (int l1 = 0; (l1 < 2); l1 = (l1 + 1)) {
-		fRec1[l1] = 0.0f;
-		fRec2[l1] = 0.0f;
+	state->q_g1 = 0;
+	state->q_y1 = 0;
+	state->q_rg = 0;
+	state->q_ry = 0;
+	state->q_z1 = 0;
+	state->q_rz = 0;
+#endif
+#if SPL_ENGINE != SPL_ENGINE_Q31
+	for (int l0 = 2; (l0 < SPL_DELTA_POLES); l0 = (l0 + 1)) {
+		state->d_y[l0] = 0.0f;
+		state->d_e[l0] = 0.0f;
 	}
+	state->d_w2 = 0.0f;
+#endif
 }
 
 /* Init A-weighing filter */
-void SPL_init_A_weighting_filter(float fs) {
-
-	SPL_reset_A_weighting_filter();
-
-	float f1 = 20.6f;
-	float f2 = 107.7f;
-	float f3 = 737.9f;
-	float f4 = 12194.0f;
-
-	w1 = 2.0f * PI * f1;
-	w2 = 2.0f * PI * f2;
-	w3 = 2.0f * PI * f3;
-	w4 = 2.0f * PI * f4;
-
-	float a0;
-	a0 = pow((w1 + 2.0f * fs), 2);
-	a1[0] = 2.0f * (pow(w1, 2) - 4.0f * pow(fs, 2)) / a0;
-	a1[1] = pow(w1 - 2.0f * fs, 2) / a0;
-	b1[0] = 2.0f * fs / a0;
-	b1[1] = 0.0f;
-	b1[2] = -2.0f * fs / a0;
-
-	a0 = w2 + 2.0f * fs;
-	b2[0] = 2.0f * fs / a0;
-	b2[1] = -2.0f * fs / a0;
-	a2 = (w2 - 2.0f * fs) / a0;
-
-	a0 = w3 + 2.0f * fs;
-	b3[0] = 2.0f * fs / a0;
-	b3[1] = -2.0f * fs / a0;
-	a3 = (w3 - 2.0f * fs) / a0;
-
-	a0 = pow((w4 + 2.0f * fs), 2);
-	a4[0] = 2.0f * (pow(w4, 2) - 4.0f * pow(fs, 2)) / a0;
-	a4[1] = pow(w4 - 2.0f * fs, 2) / a0;
-	b4[0] = 2.0f * fs / a0;
-	b4[1] = 0.0f;
-	b4[2] = -2.0f * fs / a0;
+void SPL_init_A_weighting_filter(spl_state_t *state, spl_scratch_t *scratch,
+		float fs) {
+
+	state->scratch = scratch;
+
+	/* Time weighting detectors, with periods of fs / SPL_DETECTOR_RATE
+	 * samples on average */
+	state->sampleRate = (uint32_t) lroundf(fs);
+	state->detectorPeriod = MAX(1, state->sampleRate / SPL_DETECTOR_RATE);
+	state->detectorRemainder = state->sampleRate >= SPL_DETECTOR_RATE ?
+			state->sampleRate % SPL_DETECTOR_RATE : 0;
+
+	float T = 1.0f / SPL_DETECTOR_RATE;
+
+	state->alphaFast = 1.0f - expf(-T / SPL_TAU_FAST);
+	state->alphaSlow = 1.0f - expf(-T / SPL_TAU_SLOW);
+	state->alphaImpulseRise = 1.0f - expf(-T / SPL_TAU_IMPULSE_RISE);
+	state->alphaImpulseDecay = 1.0f - expf(-T / SPL_TAU_IMPULSE_DECAY);
+
+	state->detectorSettlingPeriods = (uint32_t) lroundf(
+			SPL_DETECTOR_SETTLING_TIME / T);
+
+	state->intervalPeriods = MAX(1,
+			SPL_INTERVAL_DURATION * SPL_DETECTOR_RATE / 1000);
+
+	state->eventMinPeriods = MAX(1,
+			SPL_EVENT_MIN_DURATION * SPL_DETECTOR_RATE / 1000);
+
+	state->histogramPeriods = MAX(1,
+			SPL_HISTOGRAM_INTERVAL_DURATION * SPL_DETECTOR_RATE / 1000);
+
+#if SPL_TRUE_PEAK
+	init_true_peak(state);
+#endif
+
+#if SPL_CALIBRATION
+	state->goertzelCoefficient = 2.0f
+			* cosf(2.0f * PI * SPL_CALIBRATION_FREQUENCY / fs);
+	state->goertzelLength = MAX(1,
+			(uint32_t) (fs * SPL_CALIBRATION_SEGMENT_DURATION / 1000));
+#endif
+
+	SPL_reset_A_weighting_filter(state);
+
+	/* Use the precomputed coefficients, or design the filter with the
+	 * bilinear transform if the rate is not in the table */
+	A_weighting_coefficients_t design;
+	const A_weighting_coefficients_t *c = NULL;
+
+	for (uint32_t i = 0; i < ARRAY_LENGTH(A_weighting_table); i += 1) {
+		if (A_weighting_table[i].fs == fs) {
+			c = A_weighting_table + i;
+			break;
+		}
+	}
+
+	if (c == NULL) {
+		design = (A_weighting_coefficients_t) SPL_A_WEIGHTING_COEFFICIENTS(fs);
+		c = &design;
+	}
+
+	high_frequency_section_t high;
+
+	design_high_frequency_section(&high, fs);
+
+	/* The numerators of the four sections are (1, -2, 1) times b0^2,
+	 * (1, -1) and (1, -1) times b0 and (1, b4[0], b4[1]) times the first
+	 * coefficient of the high frequency section. The gains are collected
+	 * in G_A. The first and the last sections are the C-weighting, with
+	 * the gain G_C. */
+
+	state->b4[0] = (float) (high.b[1] / high.b[0]);
+	state->b4[1] = (float) (high.b[2] / high.b[0]);
+
+	float G4 = (float) high.b[0];
+
+	/* The gains set the weightings to 0 dB at 1 kHz, the frequency of the
+	 * calibration, so the calibration offset of the A-weighting holds for
+	 * the C and the Z-weightings. The analog gains GA and GC would leave
+	 * the digital A-weighting 0.2 dB high at 1 kHz at 8 kHz, where the
+	 * sections deviate from the analog ones. */
+	double w = 2.0 * PI * SPL_COMPENSATION_REFERENCE_FREQUENCY / fs;
+	double p = sin(0.5 * w) * sin(0.5 * w);
+
+	double powerLow = 16.0 * p * p * pole_power(c->delta[0], p)
+			* pole_power(c->delta[0], p);
+	double powerMiddle = 16.0 * p * p * pole_power(c->delta[1], p)
+			* pole_power(c->delta[2], p);
+	double powerHigh = numerator_power(high.b, w)
+			* pole_power(high.delta, p) * pole_power(high.delta, p);
+
+	float gainC = (float) (1.0 / sqrt(powerLow * powerHigh));
+	float gainA = (float) (1.0 / sqrt(powerLow * powerMiddle * powerHigh));
+
+	state->G_A = gainA * G4;
+	state->G_C = gainC * G4;
+
+	/* Z-weighting high pass (1 - z^-1) / (1 - (1 - delta) z^-1) times
+	 * (1 - delta / 2), for unit gain at high frequencies */
+	float delta_Z = 1.0f - expf(-2.0f * PI * SPL_Z_WEIGHTING_CUTOFF / fs);
+
+	state->G_Z = 1.0f - 0.5f * delta_Z;
+
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	/* The sections keep their gains, all of them have unit gain at their
+	 * peaks, and the range of the intermediate signals is bounded by
+	 * SPL_Q31_INPUT_SHIFT. The last section runs second, after the first
+	 * one. */
+	float G1 = c->b0[0] * c->b0[0];
+
+	state->q_b1 = to_q30(G1);
+	to_q30_double_pole(state->q_a1, c->delta[0]);
+	state->q_b2 = to_q30(c->b0[1]);
+	state->q_a2 = to_q30_pole(c->delta[1]);
+	state->q_b3 = to_q30(c->b0[2]);
+	state->q_a3 = to_q30_pole(c->delta[2]);
+	for (uint32_t i = 0; i < 3; i += 1) {
+		state->q_b4[i] = to_q30((float) high.b[i]);
+	}
+	to_q30_double_pole(state->q_a4, (float) high.delta);
+
+	state->G_A_q31 = gainA / (G1 * c->b0[1] * c->b0[2]);
+	state->G_C_q31 = gainC / G1;
+
+	state->q_b_Z = to_q30(state->G_Z);
+	state->q_a_Z = to_q30_pole(delta_Z);
+#endif
+
+#if SPL_ENGINE != SPL_ENGINE_Q31
+	for (uint32_t i = 0; i < 3; i += 1) {
+		state->d_delta[i] = c->delta[i];
+	}
+	state->d_delta[3] = (float) high.delta;
+	state->d_delta_Z = delta_Z;
+#endif
+
+	update_energy_scale(state);
 
 	sprintf(logFilename, "SPL.log");
 }
 
-float SPL_A_weighting_filter_step(float sample) {
-	float filteredOutput_A;
-	fRec3[0] = (sample - ((a1[0] * fRec3[1]) + (a1[1] * fRec3[2])));
-	fRec2[0] = ((((b1[0] * fRec3[0]) + (b1[1] * fRec3[1])) + (b1[2] * fRec3[2]))
-			- (a2 * fRec2[1]));
-	fRec1[0] = (((b2[0] * fRec2[0]) + (b2[1] * fRec2[1])) - (a3 * fRec1[1]));
-	fRec0[0] = (((b3[0] * fRec1[0]) + (b3[1] * fRec1[1]))
-			- ((a4[0] * fRec0[1]) + (a4[1] * fRec0[2])));
-	filteredOutput_A =
-			(float) ((GA * w4 * w4
-					* (((b4[0] * fRec0[0]) + (b4[1] * fRec0[1]))
-							+ (b4[2] * fRec0[2]))));
+#if SPL_ENGINE == SPL_ENGINE_Q31
+
+/* Fixed point block, adds the sums of the squared outputs to sum and
+ * returns the peak of the squared C-weighted output */
+static float process_block_q31(spl_state_t *state, const int16_t *src,
+		uint32_t n, double *sum) {
+
+	/* Load coefficients and state into local variables */
+	const int32_t a_comp = state->q_a_comp;
+	const int32_t b_comp = state->q_b_comp;
+#if SPL_LZEQ
+	const int32_t b_Z = state->q_b_Z;
+	const int32_t a_Z = state->q_a_Z;
+#endif
+	const int32_t b1 = state->q_b1;
+	const int32_t a10 = state->q_a1[0], a11 = state->q_a1[1];
+	const int32_t b2 = state->q_b2;
+	const int32_t a2 = state->q_a2;
+	const int32_t b3 = state->q_b3;
+	const int32_t a3 = state->q_a3;
+	const int32_t b40 = state->q_b4[0], b41 = state->q_b4[1],
+			b42 = state->q_b4[2];
+	const int32_t a40 = state->q_a4[0], a41 = state->q_a4[1];
+
+	int32_t x1 = state->q_x1;
+	int32_t c1 = state->q_c1;
+	int32_t rc = state->q_rc;
+	int32_t rd = state->q_rd;
+	int32_t z1 = state->q_z1;
+	int32_t rz = state->q_rz;
+	int32_t d1 = state->q_d[0], d2 = state->q_d[1];
+	int32_t e1 = state->q_e[0], e2 = state->q_e[1];
+	int32_t f1 = state->q_f[0], f2 = state->q_f[1];
+	int32_t g1 = state->q_g1;
+	int32_t y1 = state->q_y1;
+	int32_t rg = state->q_rg;
+	int32_t ry = state->q_ry;
+	int32_t r1 = state->q_r[0], r2 = state->q_r[1];
+
+	const int64_t mask = ((int64_t) 1 << SPL_Q31_COEFFICIENT_SHIFT) - 1;
+	const int64_t round = (int64_t) 1 << (SPL_Q31_COEFFICIENT_SHIFT - 1);
+
+	uint64_t sumA = 0;
+	uint64_t sumC = 0;
+	uint64_t sumZ = 0;
+	int64_t peakC = 0;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+
+		int64_t acc;
+
+		/* Compensation filter, two first order sections (DF-I). The poles
+		 * are close to z = 1, so the truncation errors are fed back. */
+		int32_t x = (int32_t) src[i] << SPL_Q31_INPUT_SHIFT;
+
+		acc = ((int64_t) x << SPL_Q31_COEFFICIENT_SHIFT)
+				+ (int64_t) b_comp * x1 - (int64_t) a_comp * c1 + rc;
+		int32_t c = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+		rc = (int32_t) (acc & mask);
+
+		acc = ((int64_t) c << SPL_Q31_COEFFICIENT_SHIFT)
+				+ (int64_t) b_comp * c1 - (int64_t) a_comp * d1 + rd;
+		int32_t d = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+		rd = (int32_t) (acc & mask);
+
+		x1 = x;
+		c1 = c;
+
+#if SPL_LZEQ
+		/* Z-weighting, high pass below the audio band (DF-I). The pole is
+		 * close to z = 1, so the truncation error is fed back. */
+		acc = (int64_t) b_Z * (d - d1) - (int64_t) a_Z * z1 + rz;
+		int32_t z = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+		rz = (int32_t) (acc & mask);
+
+		z1 = z;
+#endif
+
+		/* C-weighting, first and last sections of the A-weighting (DF-I).
+		 * The double pole of the first section is close to z = 1, so its
+		 * truncation error is fed back through (1 - z^-1)^2 to cancel the
+		 * round-off gain of the recursion. */
+		acc = (int64_t) b1 * (d - 2 * d1 + d2) - (int64_t) a10 * e1
+				- (int64_t) a11 * e2 + 2 * (int64_t) r1 - r2;
+		int32_t e = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+		r2 = r1;
+		r1 = (int32_t) (acc & mask);
+
+		acc = (int64_t) b40 * e + (int64_t) b41 * e1 + (int64_t) b42 * e2
+				- (int64_t) a40 * f1 - (int64_t) a41 * f2 + round;
+		int32_t f = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+
+		/* A-weighting, the two remaining sections (DF-I), with the
+		 * truncation errors fed back */
+		acc = (int64_t) b2 * (f - f1) - (int64_t) a2 * g1 + rg;
+		int32_t g = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+		rg = (int32_t) (acc & mask);
+
+		acc = (int64_t) b3 * (g - g1) - (int64_t) a3 * y1 + ry;
+		int32_t y = (int32_t) (acc >> SPL_Q31_COEFFICIENT_SHIFT);
+		ry = (int32_t) (acc & mask);
+
+		d2 = d1;
+		d1 = d;
+		e2 = e1;
+		e1 = e;
+		f2 = f1;
+		f1 = f;
+		g1 = g;
+		y1 = y;
+
+		/* Energy. Each square is below 2^62, so the sums are moved to the
+		 * double sums before they can reach 2^64. */
+		int64_t power = (int64_t) f * f;
+
+		sumA += (uint64_t) ((int64_t) y * y);
+#if SPL_LCEQ
+		sumC += (uint64_t) power;
+#endif
+#if SPL_LZEQ
+		sumZ += (uint64_t) ((int64_t) z * z);
+#endif
+
+		if ((sumA | sumC | sumZ) >> SPL_Q31_SUM_LIMIT_BITS) {
+			sum[SPL_WEIGHTING_A] += (double) sumA;
+			sum[SPL_WEIGHTING_C] += (double) sumC;
+			sum[SPL_WEIGHTING_Z] += (double) sumZ;
+			sumA = 0;
+			sumC = 0;
+			sumZ = 0;
+		}
+
+		peakC = MAX(peakC, power);
+
+	}
+
+	/* Write the state back */
+	state->q_x1 = x1;
+	state->q_c1 = c1;
+	state->q_rc = rc;
+	state->q_rd = rd;
+	state->q_z1 = z1;
+	state->q_rz = rz;
+	state->q_d[0] = d1;
+	state->q_d[1] = d2;
+	state->q_e[0] = e1;
+	state->q_e[1] = e2;
+	state->q_f[0] = f1;
+	state->q_f[1] = f2;
+	state->q_g1 = g1;
+	state->q_y1 = y1;
+	state->q_rg = rg;
+	state->q_ry = ry;
+	state->q_r[0] = r1;
+	state->q_r[1] = r2;
+
+	sum[SPL_WEIGHTING_A] += (double) sumA;
+	sum[SPL_WEIGHTING_C] += (double) sumC;
+	sum[SPL_WEIGHTING_Z] += (double) sumZ;
+
+	return (float) peakC;
+
+}
+
+#else
+
+#if SPL_ENGINE == SPL_ENGINE_FLOAT_DELTA
+
+/* Pole at z = 1 - delta. The output is y + e: y is updated with the
+ * increment and e keeps the round-off of the sum (TwoSum, exact for any
+ * magnitudes, the increment is larger than y near the Nyquist frequency),
+ * so a small increment on a large output is not truncated. */
+static inline float delta_pole(float x, float delta, float *y, float *e) {
+	float increment = x - delta * *y + *e;
+	float sum = *y + increment;
+	float z = sum - *y;
+	*e = (*y - (sum - z)) + (increment - z);
+	*y = sum;
+	return sum;
+}
+
+#else
+
+/* Pole at z = 1 - delta, without the round-off of the sum */
+static inline float delta_pole(float x, float delta, float *y, float *e) {
+	(void) e;
+	*y += x - delta * *y;
+	return *y;
+}
+
+#endif
+
+/* Delta form block, adds the sums of the squared outputs to sum and
+ * returns the peak of the squared C-weighted output. The zeros run before
+ * the poles (DF-I), so the offset of the signal is removed before the
+ * recursions close to z = 1. */
+static float process_block_delta(spl_state_t *state, const int16_t *src,
+		uint32_t n, double *sum) {
+
+	/* Load coefficients and state into local variables */
+	const float beta_comp = state->d_beta_comp;
+	const float alpha_comp = state->d_alpha_comp;
+	const float delta1 = state->d_delta[0];
+	const float delta2 = state->d_delta[1];
+	const float delta3 = state->d_delta[2];
+	const float delta4 = state->d_delta[3];
+	const float b40 = state->b4[0], b41 = state->b4[1];
+#if SPL_LZEQ
+	const float delta_Z = state->d_delta_Z;
+#endif
+
+	float y[SPL_DELTA_POLES];
+	float e[SPL_DELTA_POLES];
+
+	memcpy(y, state->d_y, sizeof(y));
+	memcpy(e, state->d_e, sizeof(e));
+
+	float x1 = state->d_x1;
+	float w2 = state->d_w2;
+
+	float sumA = 0.0f;
+	float sumC = 0.0f;
+	float sumZ = 0.0f;
+	float peakC = 0.0f;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+
+		/* Compensation filter, two first order sections with the zero at
+		 * 1 - beta and the pole at 1 - alpha */
+		float x = (float) src[i];
+		float u1 = y[0];
+		float u = delta_pole(x - x1 + beta_comp * x1, alpha_comp, &y[0],
+				&e[0]);
+		float c1 = y[1];
+		float c = delta_pole(u - u1 + beta_comp * u1, alpha_comp, &y[1],
+				&e[1]);
+		x1 = x;
+
+#if SPL_LZEQ
+		/* Z-weighting, high pass below the audio band */
+		float z = delta_pole(c - c1, delta_Z, &y[2], &e[2]);
+#endif
+
+		/* C-weighting, first and last sections of the A-weighting. The
+		 * first one is split in two high passes with the zero before each
+		 * pole, so the round-off of the differences does not see the gain
+		 * of the double pole at low frequencies. */
+		float v1 = y[3];
+		float v = delta_pole(c - c1, delta1, &y[3], &e[3]);
+		float w1 = y[4];
+		float w = delta_pole(v - v1, delta1, &y[4], &e[4]);
+
+		float s41 = y[6];
+		float r = delta_pole(w + b40 * w1 + b41 * w2, delta4, &y[5], &e[5]);
+		float s4 = delta_pole(r, delta4, &y[6], &e[6]);
+		w2 = w1;
+
+		/* A-weighting, the two remaining sections */
+		float s21 = y[7];
+		float s2 = delta_pole(s4 - s41, delta2, &y[7], &e[7]);
+		float out = delta_pole(s2 - s21, delta3, &y[8], &e[8]);
+
+		/* Energy */
+		float power = s4 * s4;
+
+		sumA += out * out;
+#if SPL_LCEQ
+		sumC += power;
+#endif
+#if SPL_LZEQ
+		sumZ += z * z;
+#endif
+
+		peakC = MAX(peakC, power);
+
+	}
+
+	/* Write the state back */
+	memcpy(state->d_y, y, sizeof(y));
+	memcpy(state->d_e, e, sizeof(e));
+	state->d_x1 = x1;
+	state->d_w2 = w2;
+
+	sum[SPL_WEIGHTING_A] += sumA;
+	sum[SPL_WEIGHTING_C] += sumC;
+	sum[SPL_WEIGHTING_Z] += sumZ;
+
+	return peakC;
+
+}
+
+#endif
+
+#if SPL_TRUE_PEAK
+
+/* Peak of the input oversampled by SPL_TRUE_PEAK_OVERSAMPLING */
+static void update_true_peak(spl_state_t *state, const int16_t *src,
+		uint32_t n) {
+
+	const float *history = state->truePeakHistory;
+	float peak = state->truePeak;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+
+		/* The last samples, from the newest */
+		float x[SPL_TRUE_PEAK_TAPS];
+
+		for (uint32_t j = 0; j < SPL_TRUE_PEAK_TAPS; j += 1) {
+			x[j] = (i >= j) ? src[i - j] :
+					history[SPL_TRUE_PEAK_TAPS + i - j];
+		}
+
+		peak = MAX(peak, fabsf(x[0]));
+
+		for (uint32_t p = 0; p < SPL_TRUE_PEAK_OVERSAMPLING - 1; p += 1) {
+			const float *taps = state->truePeakTaps[p];
+			float y = 0.0f;
+			for (uint32_t j = 0; j < SPL_TRUE_PEAK_TAPS; j += 1) {
+				y += taps[j] * x[SPL_TRUE_PEAK_TAPS - 1 - j];
+			}
+			peak = MAX(peak, fabsf(y));
+		}
+	}
+
+	state->truePeak = peak;
+
+	/* Keep the last samples, from the oldest */
+	for (uint32_t j = 0; j < SPL_TRUE_PEAK_TAPS; j += 1) {
+		state->truePeakHistory[j] = (n + j >= SPL_TRUE_PEAK_TAPS) ?
+				src[n + j - SPL_TRUE_PEAK_TAPS] :
+				state->truePeakHistory[n + j];
+	}
+}
+
+#endif
+
+#if SPL_CALIBRATION
+
+/* Power of the calibrator tone in each segment, from the squared
+ * magnitude of the Goertzel filter, and power of the segment without its
+ * mean. The short segments keep the tone within the main lobe of the
+ * filter for the frequency tolerance of the calibrators. */
+static void update_goertzel(spl_state_t *state, const int16_t *src,
+		uint32_t n) {
+
+	float coefficient = state->goertzelCoefficient;
+
+	float s1 = state->goertzelS1;
+	float s2 = state->goertzelS2;
+	float sum = state->goertzelSum;
+	float sumSquares = state->goertzelSumSquares;
+
+	uint32_t count = state->goertzelCount;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+
+		float x = (float) src[i];
+
+		float s0 = x + coefficient * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+
+		sum += x;
+		sumSquares += x * x;
+
+		count += 1;
+
+		if (count == state->goertzelLength) {
+
+			/* A sine of amplitude a gives a squared magnitude of
+			 * (a count / 2)^2 */
+			float magnitude = s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+
+			state->toneEnergy += 2.0f * magnitude / count;
+			state->signalEnergy += sumSquares - sum * sum / count;
+
+			s1 = 0.0f;
+			s2 = 0.0f;
+			sum = 0.0f;
+			sumSquares = 0.0f;
+			count = 0;
+		}
+	}
+
+	state->goertzelS1 = s1;
+	state->goertzelS2 = s2;
+	state->goertzelSum = sum;
+	state->goertzelSumSquares = sumSquares;
+	state->goertzelCount = count;
+}
+
+#endif
+
+/* Store the level of a completed interval for the main loop */
+static void update_interval(spl_state_t *state) {
+
+	uint32_t index = state->intervalWriteIndex;
+
+	if (index - state->intervalReadIndex >= SPL_INTERVAL_BUFFER_LENGTH) {
+		state->intervalsDropped += 1;
+		return;
+	}
+
+	float mean = state->intervalSum / state->intervalSamples;
+
+	float level = 100.0f * to_dB(state, SPL_WEIGHTING_A, mean);
+
+	level = MAX(INT16_MIN, MIN(INT16_MAX, level));
+
+	state->scratch->intervalBuffer[index % SPL_INTERVAL_BUFFER_LENGTH] =
+			(int16_t) lroundf(level);
+
+	state->intervalWriteIndex = index + 1;
+}
+
+/* Count the level of a completed interval in the histogram */
+static void update_histogram(spl_state_t *state) {
+
+	float mean = state->histogramSum / state->histogramSamples;
+
+	float level = to_dB(state, SPL_WEIGHTING_A, mean);
+
+	float bin = (level - SPL_HISTOGRAM_MIN_LEVEL) / SPL_HISTOGRAM_BIN_WIDTH;
+
+	bin = MAX(0.0f, MIN(SPL_HISTOGRAM_LENGTH - 1, bin));
+
+	state->scratch->histogram[(uint32_t) bin] += 1;
+	state->histogramCount += 1;
+
+	/* The dose doubles every exchange rate above the criterion level */
+	state->doseSum += exp2f(
+			(level - SPL_DOSE_CRITERION_LEVEL) / SPL_DOSE_EXCHANGE_RATE)
+			* state->histogramSamples / state->sampleRate;
+}
+
+/* Level exceeded in a fraction of the intervals of the histogram */
+static float find_statistical_level(spl_state_t *state, float fraction) {
+
+	uint32_t threshold = (uint32_t) (fraction * state->histogramCount);
+
+	uint32_t count = 0;
+
+	for (int32_t i = SPL_HISTOGRAM_LENGTH - 1; i >= 0; i -= 1) {
+		count += state->scratch->histogram[i];
+		if (count > threshold) {
+			return SPL_HISTOGRAM_MIN_LEVEL
+					+ (i + 0.5f) * SPL_HISTOGRAM_BIN_WIDTH;
+		}
+	}
+
+	return SPL_HISTOGRAM_MIN_LEVEL;
+}
+
+/* Update the detectors with the mean square of the last period */
+static void update_detectors(spl_state_t *state, float value) {
+
+	/* The detectors start at the mean of the settling periods, without
+	 * the rise time and with little of the transients of the filters */
+	if (state->detectorSettling > 0) {
+		uint32_t periods = state->detectorSettlingPeriods
+				- state->detectorSettling + 1;
+		state->fast += (value - state->fast) / periods;
+		state->slow = state->fast;
+		state->impulse = state->fast;
+		state->detectorSettling -= 1;
+		state->fastMin = state->fast;
+		return;
+	}
+
+	state->fast += state->alphaFast * (value - state->fast);
+	state->slow += state->alphaSlow * (value - state->slow);
+	state->impulse += (value > state->impulse ?
+			state->alphaImpulseRise : state->alphaImpulseDecay)
+			* (value - state->impulse);
+
+	state->fastMax = MAX(state->fastMax, state->fast);
+	state->fastMin = MIN(state->fastMin, state->fast);
+	state->slowMax = MAX(state->slowMax, state->slow);
+	state->impulseMax = MAX(state->impulseMax, state->impulse);
+}
+
+/* Store a completed event for the main loop if it lasted the minimum
+ * duration */
+static void end_event(spl_state_t *state) {
+
+	state->eventActive = false;
+
+	uint32_t periods = state->detectorPeriods - state->eventStartPeriod;
+
+	if (periods < state->eventMinPeriods) {
+		return;
+	}
+
+	uint32_t index = state->eventWriteIndex;
+
+	if (index - state->eventReadIndex >= SPL_EVENT_BUFFER_LENGTH) {
+		state->eventsDropped += 1;
+		return;
+	}
+
+	/* The exposure is the sum of the squares over the sample rate, and the
+	 * times are counted in samples, since the periods are not all of the
+	 * same length */
+	float LAmax = 100.0f * to_dB(state, SPL_WEIGHTING_A, state->eventMax);
+	float SEL = 100.0f * to_dB(state, SPL_WEIGHTING_A,
+			(float) (state->eventEnergy / state->sampleRate));
+
+	uint64_t samples = state->detectorSamples - state->eventStartSample;
+
+	spl_event_t *event = state->scratch->eventBuffer
+			+ index % SPL_EVENT_BUFFER_LENGTH;
 
-	fRec3[2] = fRec3[1];
-	fRec3[1] = fRec3[0];
-	fRec2[1] = fRec2[0];
-	fRec1[1] = fRec1[0];
-	fRec0[2] = fRec0[1];
-	fRec0[1] = fRec0[0];
+	event->time = state->eventTime;
+	event->offset = (uint32_t) (state->eventStartSample * 1000
+			/ state->sampleRate);
+	event->duration = (uint32_t) (samples * 1000 / state->sampleRate);
+	event->LAmax = (int16_t) lroundf(MAX(INT16_MIN, MIN(INT16_MAX, LAmax)));
+	event->SEL = (int16_t) lroundf(MAX(INT16_MIN, MIN(INT16_MAX, SEL)));
 
-	return filteredOutput_A;
+	state->eventWriteIndex = index + 1;
+}
+
+/* Compare the Fast level with the thresholds of the events, the sum is
+ * the sum of the squares of the last period */
+static void update_event(spl_state_t *state, float sum) {
+
+	if (!state->eventActive) {
+
+		if (state->fast > state->eventStart) {
+			state->eventActive = true;
+			state->eventStartPeriod = state->detectorPeriods;
+			state->eventStartSample = state->detectorSamples;
+			state->eventEnergy = 0.0;
+			state->eventMax = 0.0f;
+		}
+
+	} else if (state->fast < state->eventEnd) {
+
+		end_event(state);
+
+	}
+
+	if (state->eventActive) {
+		state->eventEnergy += sum;
+		state->eventMax = MAX(state->eventMax, state->fast);
+	}
+}
+
+/* Process a block of samples */
+void SPL_process_block(spl_state_t *state, const int16_t *src, uint32_t n) {
+
+	double sum[SPL_NUMBER_OF_WEIGHTINGS] = { 0.0 };
+
+	state->n += n;
+
+#if SPL_TRUE_PEAK
+	update_true_peak(state, src, n);
+#endif
+
+#if SPL_CALIBRATION
+	update_goertzel(state, src, n);
+#endif
+
+	/* Split the block at the updates of the detectors */
+	while (n > 0) {
+
+		uint32_t m = MIN(n, state->detectorCountdown);
+
+		double partial = sum[SPL_WEIGHTING_A];
+
+#if SPL_ENGINE == SPL_ENGINE_Q31
+		float peak = process_block_q31(state, src, m, sum);
+#else
+		float peak = process_block_delta(state, src, m, sum);
+#endif
+
+		partial = sum[SPL_WEIGHTING_A] - partial;
+
+		/* The peak starts after the settling of the filters */
+		if (state->detectorSettling == 0) {
+			state->peakC = MAX(state->peakC, peak);
+		}
+
+		src += m;
+		n -= m;
+
+		state->detectorSum += (float) partial;
+		state->detectorCountdown -= m;
+
+		if (state->detectorCountdown == 0) {
+			float value = state->detectorSum / state->detectorLength;
+
+			update_detectors(state, value);
+
+			/* Events start after the settling of the detectors */
+			if (state->detectorSettling == 0) {
+				update_event(state, state->detectorSum);
+			}
+
+			state->detectorPeriods += 1;
+			state->detectorSamples += state->detectorLength;
+
+			state->intervalSum += state->detectorSum;
+			state->intervalSamples += state->detectorLength;
+			state->intervalCountdown -= 1;
+
+			if (state->intervalCountdown == 0) {
+				update_interval(state);
+				state->intervalSum = 0.0f;
+				state->intervalSamples = 0;
+				state->intervalCountdown = state->intervalPeriods;
+			}
+
+			/* The histogram starts after the settling of the detectors */
+			if (state->detectorSettling == 0) {
+				state->histogramSum += state->detectorSum;
+				state->histogramSamples += state->detectorLength;
+				state->histogramCountdown -= 1;
+
+				if (state->histogramCountdown == 0) {
+					update_histogram(state);
+					state->histogramSum = 0.0f;
+					state->histogramSamples = 0;
+					state->histogramCountdown = state->histogramPeriods;
+				}
+			}
+
+			state->detectorSum = 0.0f;
+			state->detectorLength = next_detector_period(state);
+			state->detectorCountdown = state->detectorLength;
+		}
+
+	}
+
+	/* Add the partial sums of the block to the energies. The compensation
+	 * term keeps the error of the running sum independent of its length */
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_WEIGHTINGS; i += 1) {
+		double y = sum[i] - state->energyCompensation[i];
+		double t = state->energy[i] + y;
+		state->energyCompensation[i] = (t - state->energy[i]) - y;
+		state->energy[i] = t;
+	}
+
+}
+
+/* Open the short interval Leq file. The intervals take the duration of
+ * their periods, SPL_INTERVAL_DURATION ms on average. */
+bool SPL_open_interval_file(spl_state_t *state, char *filename,
+		uint32_t currentTime) {
+
+	intervalHeader_t header = { .id = "SPLI", .time = currentTime,
+			.sampleRate = state->sampleRate,
+			.intervalDuration = state->intervalPeriods * 1000
+					/ SPL_DETECTOR_RATE };
+
+	if (!AudioMoth_openAuxiliaryFile(SPL_INTERVAL_FILE, filename)) {
+		return false;
+	}
+
+	return AudioMoth_writeToAuxiliaryFile(SPL_INTERVAL_FILE, &header,
+			sizeof(intervalHeader_t));
+}
+
+/* Write the intervals completed since the last call */
+bool SPL_write_intervals(spl_state_t *state) {
+
+	uint32_t readIndex = state->intervalReadIndex;
+	uint32_t writeIndex = state->intervalWriteIndex;
+
+	while (readIndex != writeIndex) {
+
+		/* Contiguous part of the ring buffer */
+		uint32_t start = readIndex % SPL_INTERVAL_BUFFER_LENGTH;
+		uint32_t length = MIN(writeIndex - readIndex,
+				SPL_INTERVAL_BUFFER_LENGTH - start);
+
+		if (!AudioMoth_writeToAuxiliaryFile(SPL_INTERVAL_FILE,
+				state->scratch->intervalBuffer + start, 2 * length)) {
+			return false;
+		}
+
+		readIndex += length;
+		state->intervalReadIndex = readIndex;
+	}
+
+	return true;
+}
+
+/* Close the short interval Leq file */
+bool SPL_close_interval_file(spl_state_t *state) {
+
+	bool success = SPL_write_intervals(state);
+
+	return AudioMoth_closeAuxiliaryFile(SPL_INTERVAL_FILE) && success;
+}
+
+/* Open the noise event file */
+bool SPL_open_event_file(spl_state_t *state, char *filename,
+		uint32_t currentTime) {
+
+	/* Thresholds of the Fast level in mean square units */
+	float scale = state->energyScale[SPL_WEIGHTING_A];
+
+	state->eventStart = powf(10.0f,
+			(SPL_EVENT_THRESHOLD - state->cal_offset) / 10.0f) / scale;
+	state->eventEnd = powf(10.0f,
+			(SPL_EVENT_THRESHOLD - SPL_EVENT_HYSTERESIS - state->cal_offset)
+					/ 10.0f) / scale;
+
+	state->eventTime = currentTime;
+
+	return AudioMoth_appendAuxiliaryFile(SPL_EVENT_FILE, filename);
+}
+
+/* Write the events completed since the last call */
+bool SPL_write_events(spl_state_t *state) {
+
+	uint32_t readIndex = state->eventReadIndex;
+	uint32_t writeIndex = state->eventWriteIndex;
+
+	while (readIndex != writeIndex) {
+
+		/* Contiguous part of the ring buffer */
+		uint32_t start = readIndex % SPL_EVENT_BUFFER_LENGTH;
+		uint32_t length = MIN(writeIndex - readIndex,
+				SPL_EVENT_BUFFER_LENGTH - start);
+
+		if (!AudioMoth_writeToAuxiliaryFile(SPL_EVENT_FILE,
+				state->scratch->eventBuffer + start,
+				length * sizeof(spl_event_t))) {
+			return false;
+		}
+
+		readIndex += length;
+		state->eventReadIndex = readIndex;
+	}
+
+	return true;
+}
+
+/* Close the noise event file */
+bool SPL_close_event_file(spl_state_t *state) {
+
+	/* An event at the end of the recording ends with it */
+	if (state->eventActive) {
+		end_event(state);
+	}
+
+	bool success = SPL_write_events(state);
+
+	return AudioMoth_closeAuxiliaryFile(SPL_EVENT_FILE) && success;
 }
 
 /* Find calibration offset in function of gain */
-void SPL_find_calibration_offset(int gain) {
-	cal_offset = 0.0;
-	switch (gain) {
-	case 0:
-		cal_offset = CALdBA_low;
-		break;
-	case 1:
-		cal_offset = CALdBA_low_med;
-		break;
-	case 2:
-		cal_offset = CALdBA_med;
-		break;
-	case 3:
-		cal_offset = CALdBA_med_high;
-		break;
-	case 4:
-		cal_offset = CALdBA_high;
-		break;
+void SPL_find_calibration_offset(spl_state_t *state, int gain) {
+	state->cal_offset = 0.0;
+	if (gain >= 0 && gain < SPL_NUMBER_OF_GAINS) {
+		state->cal_offset = calibrationOffsets[gain];
+	}
+}
+
+/* Step the gain for the levels of the last recording */
+uint32_t SPL_find_next_gain(spl_state_t *state, uint32_t gain) {
+
+	if (gain >= SPL_NUMBER_OF_GAINS) {
+		return gain;
+	}
+
+	/* Peak of the recorded samples and L90 relative to the full scale */
+	float peak = 20.0f * log10f(MAX(state->samplePeak, 1)
+			/ SPL_TRUE_PEAK_FULL_SCALE);
+	float L90 = state->L90 - full_scale_dB(state);
+
+	if (gain > 0
+			&& (state->samplesSaturated > 0 || state->samplesClipped > 0
+					|| peak >= SPL_AUTO_GAIN_MAX_PEAK)) {
+		return gain - 1;
+	}
+
+	/* The calibration offsets fall by the step of the gain */
+	if (gain < SPL_NUMBER_OF_GAINS - 1 && L90 < SPL_AUTO_GAIN_MIN_L90) {
+		float step = calibrationOffsets[gain] - calibrationOffsets[gain + 1];
+		if (peak + step < SPL_AUTO_GAIN_MAX_PEAK) {
+			return gain + 1;
+		}
+	}
+
+	return gain;
+}
+
+/* Move the offsets of the gains that were not measured by the mean
+ * correction of the measured gains. The difference between the devices
+ * is the sensitivity of the microphone, which is the same at every gain,
+ * and the calibrator clips at the higher gains. */
+static void update_calibration_offsets(void) {
+
+	float correction = 0.0f;
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_GAINS; i += 1) {
+		if (calibrated[i]) {
+			correction += calibrationOffsets[i] - defaultOffsets[i];
+			count += 1;
+		}
+	}
+
+	if (count == 0) {
+		return;
+	}
+
+	correction /= count;
+
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_GAINS; i += 1) {
+		if (!calibrated[i]) {
+			calibrationOffsets[i] = defaultOffsets[i] + correction;
+		}
+	}
+}
+
+/* Read the offsets of the calibrated gains */
+bool SPL_read_calibration(char *filename) {
+
+	char buffer[SPL_CALIBRATION_FILE_LENGTH + 1];
+
+	memset(buffer, 0, sizeof(buffer));
+
+	AudioMoth_enableFileSystem();
+
+	if (!AudioMoth_openFileToRead(filename)) {
+		return false;
+	}
+
+	bool success = AudioMoth_readFile(buffer, SPL_CALIBRATION_FILE_LENGTH);
+
+	AudioMoth_closeFile();
+
+	/* Lines of the gain and the offset in hundredths of dB */
+	char *line = buffer;
+
+	unsigned int gain;
+	int offset;
+
+	while (success && sscanf(line, "%u %d", &gain, &offset) == 2) {
+
+		if (gain < SPL_NUMBER_OF_GAINS) {
+			calibrationOffsets[gain] = offset / 100.0f;
+			calibrated[gain] = true;
+		}
+
+		line = strchr(line, '\n');
+
+		if (line == NULL) {
+			break;
+		}
+
+		line += 1;
+	}
+
+	update_calibration_offsets();
+
+	return success;
+}
+
+#if SPL_CALIBRATION
+
+/* Set the offset of the gain from the level of the calibrator */
+bool SPL_calibrate(spl_state_t *state, uint32_t gain) {
+
+	if (gain >= SPL_NUMBER_OF_GAINS || state->signalEnergy <= 0.0f) {
+		return false;
+	}
+
+	/* The tone must dominate the recording without clipping */
+	if (state->toneEnergy < SPL_CALIBRATION_MIN_PURITY * state->signalEnergy
+			|| state->samplesSaturated > 0 || state->samplesClipped > 0
+			|| state->samplePeak >= SPL_NEAR_FULL_SCALE) {
+		return false;
+	}
+
+	/* The calibrator levels are far apart compared with the spread of the
+	 * microphones, so the nearest one is the level of the tone */
+	float reference =
+			fabsf(state->spl - SPL_CALIBRATION_LOW_LEVEL)
+					< fabsf(state->spl - SPL_CALIBRATION_HIGH_LEVEL) ?
+					SPL_CALIBRATION_LOW_LEVEL : SPL_CALIBRATION_HIGH_LEVEL;
+
+	if (fabsf(state->spl - reference) > SPL_CALIBRATION_MAX_ERROR) {
+		return false;
 	}
+
+	calibrationOffsets[gain] = state->cal_offset + reference - state->spl;
+	calibrated[gain] = true;
+
+	update_calibration_offsets();
+
+	return true;
+}
+
+#endif
+
+/* Write the offsets of the calibrated gains */
+bool SPL_write_calibration(char *filename) {
+
+	AudioMoth_enableFileSystem();
+
+	if (!AudioMoth_openFile(filename)) {
+		return false;
+	}
+
+	bool success = true;
+
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_GAINS; i += 1) {
+		if (calibrated[i]) {
+			sprintf(logBuffer, "%u %d\n", (unsigned int) i,
+					(int) lroundf(100.0f * calibrationOffsets[i]));
+			success &= AudioMoth_writeToFile(logBuffer,
+					strnlen(logBuffer, LOG_BUFFER_LENGTH));
+		}
+	}
+
+	success &= AudioMoth_closeFile();
+
+	return success;
 }
 
 /* Convert float number to string */
@@ -221,11 +1478,12 @@ void float_to_string(char* string, float value) {
 	float tmpFrac = tmpVal - tmpInt1;      // Get fraction (0.0123).
 	int tmpInt2 = trunc(tmpFrac * 10000);  // Turn into integer (123).
 
-	sprintf(string, "%s%d.%01d ", tmpSign, tmpInt1, tmpInt2);
+	sprintf(string, "%s%d.%04d ", tmpSign, tmpInt1, tmpInt2);
 }
 
 /* Append message (spl value) to logfile */
-void SPL_write_log(uint32_t currentTime) {
+void SPL_write_log(spl_state_t *state, uint32_t currentTime,
+		const float *values, uint32_t numberOfValues) {
 
 	AudioMoth_enableFileSystem();
 
@@ -239,7 +1497,49 @@ void SPL_write_log(uint32_t currentTime) {
 
 	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
 
-	float_to_string(logBuffer, spl);
+	float_to_string(logBuffer, state->spl);
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	/* Time weighted and statistical levels */
+	float levels[] = { state->LAFmax, state->LASmax, state->LAImax,
+			state->LAFmin, state->L10, state->L50, state->L90, state->L95,
+			state->LCeq, state->LZeq, state->LCpeak };
+
+	for (uint32_t i = 0; i < ARRAY_LENGTH(levels); i += 1) {
+		float_to_string(logBuffer, levels[i]);
+		AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+	}
+
+#if SPL_TRUE_PEAK
+	float_to_string(logBuffer, state->dBTP);
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+#endif
+
+	/* Values of other modules */
+	for (uint32_t i = 0; i < numberOfValues; i += 1) {
+		float_to_string(logBuffer, values[i]);
+		AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+	}
+
+	/* Percentage of saturated, near full scale and under range recorded
+	 * samples, longest overload burst of recorded samples and percentage of
+	 * clipped samples of the pipeline */
+	float counted = (float) MAX(state->samplesCounted, 1);
+	float processed = (float) MAX(state->n, 1);
+
+	float statistics[] = { 100.0f * state->samplesSaturated / counted,
+			100.0f * state->samplesNearFullScale / counted,
+			100.0f * state->samplesUnderRange / counted };
+
+	for (uint32_t i = 0; i < ARRAY_LENGTH(statistics); i += 1) {
+		float_to_string(logBuffer, statistics[i]);
+		AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+	}
+
+	sprintf(logBuffer, "%u ", (unsigned int) state->longestOverloadBurst);
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	float_to_string(logBuffer, 100.0f * state->samplesClipped / processed);
 	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
 
 	AudioMoth_writeToFile("\n", 1);
@@ -247,14 +1547,223 @@ void SPL_write_log(uint32_t currentTime) {
 	AudioMoth_closeFile();
 }
 
-/* Update SPL value */
-void SPL_update_value(float value) {
-	// Mean value of SPL sequence
-	spl = (n*spl + value*value)/(n+1); // y[n] = (n*y[n]+x^2[n])/(n+1)
-	n += 1;
+/* Periods of the day levels between consecutive times of the day */
+static const uint32_t rollupBoundaries[] = { 0, SPL_DAY_START,
+		SPL_EVENING_START, SPL_LDN_NIGHT_START, SPL_NIGHT_START,
+		SPL_SECONDS_IN_DAY };
+
+static const uint32_t rollupPeriods[] = { SPL_ROLLUP_NIGHT, SPL_ROLLUP_DAY,
+		SPL_ROLLUP_EVENING, SPL_ROLLUP_LATE_EVENING, SPL_ROLLUP_NIGHT };
+
+/* Reset the day levels */
+void SPL_reset_rollup(spl_rollup_t *rollup, uint32_t day) {
+	rollup->day = day;
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_ROLLUP_PERIODS; i += 1) {
+		rollup->energy[i] = 0.0f;
+		rollup->duration[i] = 0.0f;
+	}
+}
+
+/* Mean energy of two periods of the day levels, 0 if they were not
+ * measured */
+static float rollup_mean(spl_rollup_t *rollup, uint32_t a, uint32_t b) {
+
+	float duration = rollup->duration[a] + rollup->duration[b];
+
+	if (duration <= 0.0f) {
+		return 0.0f;
+	}
+
+	return (rollup->energy[a] + rollup->energy[b]) / duration;
+}
+
+/* Level of a mean energy, 0 if it was not measured */
+static float rollup_level(float energy) {
+	return energy > 0.0f ? 10.0f * log10f(energy) : 0.0f;
+}
+
+/* Append the levels of the stored day to the day log file */
+static void write_rollup(spl_rollup_t *rollup) {
+
+	float total = 0.0f;
+
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_ROLLUP_PERIODS; i += 1) {
+		total += rollup->duration[i];
+	}
+
+	if (total <= 0.0f) {
+		return;
+	}
+
+	/* Day, evening and night of Lden, day and night of Ldn */
+	float day = rollup_mean(rollup, SPL_ROLLUP_DAY, SPL_ROLLUP_DAY);
+	float evening = rollup_mean(rollup, SPL_ROLLUP_EVENING,
+			SPL_ROLLUP_LATE_EVENING);
+	float night = rollup_mean(rollup, SPL_ROLLUP_NIGHT, SPL_ROLLUP_NIGHT);
+	float dnDay = rollup_mean(rollup, SPL_ROLLUP_DAY, SPL_ROLLUP_EVENING);
+	float dnNight = rollup_mean(rollup, SPL_ROLLUP_LATE_EVENING,
+			SPL_ROLLUP_NIGHT);
+
+	/* 5 dB and 10 dB penalties on the evening and the night */
+	float Lden = 0.0f;
+
+	if (day > 0.0f && evening > 0.0f && night > 0.0f) {
+		Lden = rollup_level((12.0f * day + 4.0f * 3.1622777f * evening
+				+ 8.0f * 10.0f * night) / 24.0f);
+	}
+
+	float Ldn = 0.0f;
+
+	if (dnDay > 0.0f && dnNight > 0.0f) {
+		Ldn = rollup_level((15.0f * dnDay + 9.0f * 10.0f * dnNight) / 24.0f);
+	}
+
+	float levels[] = { Lden, Ldn, rollup_level(day), rollup_level(evening),
+			rollup_level(night), rollup->duration[SPL_ROLLUP_DAY] / 3600.0f,
+			(rollup->duration[SPL_ROLLUP_EVENING]
+					+ rollup->duration[SPL_ROLLUP_LATE_EVENING]) / 3600.0f,
+			rollup->duration[SPL_ROLLUP_NIGHT] / 3600.0f };
+
+	AudioMoth_enableFileSystem();
+
+	AudioMoth_appendFile(rollupFilename);
+
+	time_t rawtime = (time_t) rollup->day * SPL_SECONDS_IN_DAY;
+
+	struct tm *time = gmtime(&rawtime);
+
+	sprintf(logBuffer, "%02d/%02d/%04d: ", time->tm_mday, time->tm_mon + 1,
+			time->tm_year + 1900);
+
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	for (uint32_t i = 0; i < ARRAY_LENGTH(levels); i += 1) {
+		float_to_string(logBuffer, levels[i]);
+		AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+	}
+
+	AudioMoth_writeToFile("\n", 1);
+
+	AudioMoth_closeFile();
+}
+
+/* Add a recording to the day levels */
+void SPL_update_rollup(spl_state_t *state, spl_rollup_t *rollup,
+		uint32_t localTime, uint32_t duration) {
+
+	float energy = powf(10.0f, state->spl / 10.0f);
+
+	uint32_t end = localTime + duration;
+
+	/* Split the recording at midnight */
+	while (localTime < end) {
+
+		uint32_t day = localTime / SPL_SECONDS_IN_DAY;
+
+		if (day != rollup->day) {
+			if (day > rollup->day) {
+				write_rollup(rollup);
+			}
+			SPL_reset_rollup(rollup, day);
+		}
+
+		uint32_t midnight = day * SPL_SECONDS_IN_DAY;
+		uint32_t start = localTime - midnight;
+		uint32_t stop = MIN(end, midnight + SPL_SECONDS_IN_DAY) - midnight;
+
+		/* Part of the recording in each period */
+		for (uint32_t i = 0; i < ARRAY_LENGTH(rollupPeriods); i += 1) {
+			uint32_t a = MAX(start, rollupBoundaries[i]);
+			uint32_t b = MIN(stop, rollupBoundaries[i + 1]);
+			if (b > a) {
+				rollup->energy[rollupPeriods[i]] += energy * (b - a);
+				rollup->duration[rollupPeriods[i]] += (float) (b - a);
+			}
+		}
+
+		localTime = midnight + stop;
+	}
+}
+
+/* Reset the exposure of the shift */
+void SPL_reset_exposure(spl_exposure_t *exposure, uint32_t shift) {
+	exposure->shift = shift;
+	exposure->energy = 0.0f;
+	exposure->duration = 0.0f;
+	exposure->dose = 0.0f;
+}
+
+/* Add a recording to the exposure and append the exposure to its file */
+void SPL_update_exposure(spl_state_t *state, spl_exposure_t *exposure,
+		uint32_t currentTime, uint32_t localTime, uint32_t duration) {
+
+	uint32_t shift = (localTime - SPL_SHIFT_START) / SPL_SECONDS_IN_DAY;
+
+	if (shift != exposure->shift) {
+		SPL_reset_exposure(exposure, shift);
+	}
+
+	exposure->energy += powf(10.0f, state->spl / 10.0f) * duration;
+	exposure->duration += (float) duration;
+	exposure->dose += 100.0f * state->doseSum / SPL_DOSE_REFERENCE_DURATION;
+
+	if (exposure->duration <= 0.0f) {
+		return;
+	}
+
+	float levels[] = { 10.0f * log10f(exposure->energy
+			/ SPL_DOSE_REFERENCE_DURATION), exposure->dose, exposure->dose
+			* SPL_DOSE_REFERENCE_DURATION / exposure->duration,
+			exposure->duration / 3600.0f };
+
+	AudioMoth_enableFileSystem();
+
+	AudioMoth_appendFile(exposureFilename);
+
+	time_t rawtime = currentTime;
+
+	struct tm *time = gmtime(&rawtime);
+
+	sprintf(logBuffer, "%02d/%02d/%04d %02d:%02d:%02d: ", time->tm_mday,
+			time->tm_mon + 1, time->tm_year + 1900, time->tm_hour, time->tm_min,
+			time->tm_sec);
+
+	AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+
+	for (uint32_t i = 0; i < ARRAY_LENGTH(levels); i += 1) {
+		float_to_string(logBuffer, levels[i]);
+		AudioMoth_writeToFile(logBuffer, strnlen(logBuffer, LOG_BUFFER_LENGTH));
+	}
+
+	AudioMoth_writeToFile("\n", 1);
+
+	AudioMoth_closeFile();
 }
 
 /* convert SPL value to dB */
-void SPL_to_dB() {
-	spl = 10.0f*log10f(spl) + cal_offset; //to dB
+void SPL_to_dB(spl_state_t *state) {
+	float mean[SPL_NUMBER_OF_WEIGHTINGS] = { 0.0f };
+	if (state->n > 0) {
+		for (uint32_t i = 0; i < SPL_NUMBER_OF_WEIGHTINGS; i += 1) {
+			mean[i] = (float) (state->energy[i] / (double) state->n);
+		}
+	}
+	state->spl = to_dB(state, SPL_WEIGHTING_A, mean[SPL_WEIGHTING_A]); //to dB
+	state->LCeq = to_dB(state, SPL_WEIGHTING_C, mean[SPL_WEIGHTING_C]);
+	state->LZeq = to_dB(state, SPL_WEIGHTING_Z, mean[SPL_WEIGHTING_Z]);
+
+	state->LAFmax = to_dB(state, SPL_WEIGHTING_A, state->fastMax);
+	state->LAFmin = to_dB(state, SPL_WEIGHTING_A, state->fastMin);
+	state->LASmax = to_dB(state, SPL_WEIGHTING_A, state->slowMax);
+	state->LAImax = to_dB(state, SPL_WEIGHTING_A, state->impulseMax);
+
+	state->LCpeak = to_dB(state, SPL_WEIGHTING_C, state->peakC);
+#if SPL_TRUE_PEAK
+	state->dBTP = 20.0f * log10f(state->truePeak / SPL_TRUE_PEAK_FULL_SCALE);
+#endif
+
+	state->L10 = find_statistical_level(state, 0.10f);
+	state->L50 = find_statistical_level(state, 0.50f);
+	state->L90 = find_statistical_level(state, 0.90f);
+	state->L95 = find_statistical_level(state, 0.95f);
 }
@@ -0,0 +1,175 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        bench_decimator.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host benchmark of the polyphase FIR decimator against the sum of
+ * consecutive samples of filter() in main.c. Prints the time per output
+ * sample and the smallest attenuation of the tones that alias into the
+ * pass band, up to 0.4 times the output rate. */
+#include "decimator.h"
+#include "test.h"
+
+#define OUTPUT_RATE                         48000.0f
+#define BLOCK_LENGTH                        2048
+#define BENCHMARK_SAMPLES                   (8 * 1024 * 1024)
+#define BENCHMARK_REPETITIONS               5
+
+#define ALIAS_LENGTH                        (64 * 1024)
+#define ALIAS_STEPS                         9
+
+#define NUMBER_OF_DIVIDERS                  4
+
+static const uint32_t dividers[NUMBER_OF_DIVIDERS] = { 2, 4, 8, 16 };
+
+static decimator_state_t state;
+
+static int16_t input[DECIMATOR_HISTORY_LENGTH + BLOCK_LENGTH];
+static int16_t output[BLOCK_LENGTH];
+
+static int8_t shift;
+
+/* Sum of consecutive samples as in filter(), with unit gain */
+static uint32_t boxcar(int16_t *buffer, uint32_t n, uint32_t divider,
+		int16_t *dest) {
+
+	uint32_t index = 0;
+
+	for (uint32_t i = 0; i < n; i += divider) {
+
+		int32_t sample = 0;
+
+		for (uint32_t j = 0; j < divider; j += 1) {
+			sample += (int32_t) buffer[i + j];
+		}
+
+		dest[index++] = (int16_t) (sample >> -shift);
+	}
+
+	return index;
+}
+
+static uint32_t fir(int16_t *buffer, uint32_t n, uint32_t divider,
+		int16_t *dest) {
+	(void) divider;
+	return DECIMATOR_copy_block(&state, buffer, n, dest);
+}
+
+static void init(uint32_t divider) {
+	shift = 0;
+	while ((1U << -shift) < divider) {
+		shift -= 1;
+	}
+	DECIMATOR_init(&state, divider, shift);
+}
+
+/* Best time per output sample in ns */
+static double time_decimator(uint32_t (*decimate)(int16_t*, uint32_t,
+		uint32_t, int16_t*), uint32_t divider) {
+
+	test_signal_t signal;
+
+	init(divider);
+
+	int16_t *buffer = input + DECIMATOR_HISTORY_LENGTH;
+
+	TEST_init_signal(&signal, 1000.0, 10000.0, 0.0, 100.0);
+	TEST_generate(&signal, divider * OUTPUT_RATE, buffer, BLOCK_LENGTH);
+
+	double best = INFINITY;
+
+	for (uint32_t k = 0; k < BENCHMARK_REPETITIONS; k += 1) {
+
+		double start = TEST_seconds();
+
+		for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i += BLOCK_LENGTH) {
+			decimate(buffer, BLOCK_LENGTH, divider, output);
+		}
+
+		double time = (TEST_seconds() - start) * divider / BENCHMARK_SAMPLES;
+
+		best = time < best ? time : best;
+	}
+
+	return 1e9 * best;
+}
+
+/* Smallest attenuation in dB of the tones that alias into the pass band */
+static double alias_rejection(uint32_t (*decimate)(int16_t*, uint32_t,
+		uint32_t, int16_t*), uint32_t divider) {
+
+	double worst = INFINITY;
+
+	int16_t *buffer = input + DECIMATOR_HISTORY_LENGTH;
+
+	for (uint32_t m = 1; m <= divider / 2; m += 1) {
+		for (uint32_t k = 0; k < ALIAS_STEPS; k += 1) {
+
+			double frequency = (m - 0.4 + 0.8 * k / (ALIAS_STEPS - 1))
+					* OUTPUT_RATE;
+
+			if (frequency >= 0.5 * divider * OUTPUT_RATE) {
+				continue;
+			}
+
+			double amplitude = 30000.0;
+
+			test_signal_t signal;
+
+			TEST_init_signal(&signal, frequency, amplitude, 0.0, 0.0);
+
+			init(divider);
+
+			double sum = 0.0;
+			uint32_t count = 0;
+
+			for (uint32_t i = 0; i < ALIAS_LENGTH; i += BLOCK_LENGTH) {
+
+				TEST_generate(&signal, divider * OUTPUT_RATE, buffer,
+						BLOCK_LENGTH);
+
+				uint32_t n = decimate(buffer, BLOCK_LENGTH, divider, output);
+
+				/* The first block lets the taps settle */
+				for (uint32_t j = 0; j < n && i > 0; j += 1) {
+					sum += (double) output[j] * output[j];
+					count += 1;
+				}
+			}
+
+			double rms = sqrt(sum / count);
+
+			double attenuation = rms > 0.0 ? -20.0 * log10(rms * sqrt(2.0)
+					/ amplitude) : INFINITY;
+
+			worst = attenuation < worst ? attenuation : worst;
+		}
+	}
+
+	return worst;
+}
+
+int main(void) {
+
+	printf("%8s %14s %14s %12s %12s\n", "Divider", "Boxcar (ns)", "FIR (ns)",
+			"Boxcar (dB)", "FIR (dB)");
+
+	for (uint32_t d = 0; d < NUMBER_OF_DIVIDERS; d += 1) {
+
+		uint32_t divider = dividers[d];
+
+		printf("%8u %14.2f %14.2f %12.1f %12.1f\n", (unsigned int) divider,
+				time_decimator(boxcar, divider), time_decimator(fir, divider),
+				alias_rejection(boxcar, divider),
+				alias_rejection(fir, divider));
+	}
+
+	return 0;
+}
@@ -0,0 +1,81 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        bench_octave.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host benchmark of the octave and third-octave band filter bank. Prints
+ * the time per input sample of the whole bank and of its first stage,
+ * the bands filtered at the input rate. */
+#include "octave.h"
+#include "test.h"
+
+#define BLOCK_LENGTH                        1024
+#define BENCHMARK_SAMPLES                   (4 * 1024 * 1024)
+#define BENCHMARK_REPETITIONS               5
+
+#define NUMBER_OF_RATES                     7
+
+static const float rates[NUMBER_OF_RATES] = { 8000.0f, 16000.0f, 32000.0f,
+		48000.0f, 62500.0f, 96000.0f, 384000.0f };
+
+static octave_state_t state;
+
+static int16_t buffer[BLOCK_LENGTH];
+
+/* Best time per input sample in ns, of the first stage alone if first */
+static double time_filter_bank(float fs, bool first) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, 1000.0, 1000.0, 0.0, 100.0);
+	TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+
+	OCTAVE_init_filter_bank(&state, fs);
+
+	if (first) {
+		state.numberOfStages = state.numberOfDecimationStages + 1;
+	}
+
+	double best = INFINITY;
+
+	for (uint32_t k = 0; k < BENCHMARK_REPETITIONS; k += 1) {
+
+		double start = TEST_seconds();
+
+		for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i += BLOCK_LENGTH) {
+			OCTAVE_process_block(&state, buffer, BLOCK_LENGTH);
+		}
+
+		double time = (TEST_seconds() - start) / BENCHMARK_SAMPLES;
+
+		best = time < best ? time : best;
+	}
+
+	return 1e9 * best;
+}
+
+int main(void) {
+
+	printf("%10s %8s %14s %14s %8s\n", "fs (Hz)", "Bands", "Bank (ns)",
+			"First (ns)", "Ratio");
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		double bank = time_filter_bank(rates[r], false);
+		double first = time_filter_bank(rates[r], true);
+
+		OCTAVE_init_filter_bank(&state, rates[r]);
+
+		printf("%10.0f %8u %14.2f %14.2f %8.2f\n", rates[r],
+				(unsigned int) state.numberOfBands, bank, first, bank / first);
+	}
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        bench_spectrum.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host benchmark of the Welch spectrum and of the tone detector. Prints
+ * the time of a spectrum frame and of a tone frame, the time between
+ * frames and the share of the time of the samples that the frames take,
+ * which must stay well below 100 % for the main loop to keep up with the
+ * DMA transfers. */
+#include "spectrum.h"
+#include "test.h"
+
+#define BLOCK_LENGTH                        1024
+#define BENCHMARK_TIME                      100.0f
+#define BENCHMARK_REPETITIONS               5
+
+#define NUMBER_OF_RATES                     6
+
+static const float rates[NUMBER_OF_RATES] = { 8000.0f, 16000.0f, 32000.0f,
+		48000.0f, 62500.0f, 64000.0f };
+
+static spectrum_scratch_t scratch;
+static spectrum_state_t state;
+
+static int16_t buffer[BLOCK_LENGTH];
+
+/* Best time per spectrum frame, or per tone frame if tones, in us */
+static double time_frame(float fs, bool tones) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, 1000.0, 1000.0, 200.0, 100.0);
+	TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+
+	float toneFs = fminf(fs, SPECTRUM_TONE_SAMPLE_RATE);
+
+	uint32_t blocks = (uint32_t) (BENCHMARK_TIME * fs) / BLOCK_LENGTH;
+
+	double best = INFINITY;
+
+	for (uint32_t k = 0; k < BENCHMARK_REPETITIONS; k += 1) {
+
+		SPECTRUM_init(&state, &scratch, fs, toneFs);
+
+		double start = TEST_seconds();
+
+		for (uint32_t i = 0; i < blocks; i += 1) {
+			if (tones) {
+				SPECTRUM_add_tone_samples(&state, buffer, BLOCK_LENGTH);
+				SPECTRUM_process_tones(&state);
+			} else {
+				SPECTRUM_process_block(&state, buffer, BLOCK_LENGTH);
+			}
+		}
+
+		uint32_t frames = tones ? state.toneFramesRead : state.numberOfFrames;
+
+		double time = (TEST_seconds() - start) / (frames > 0 ? frames : 1);
+
+		best = time < best ? time : best;
+	}
+
+	return 1e6 * best;
+}
+
+int main(void) {
+
+	printf("%10s %12s %10s %12s %10s %8s\n", "fs (Hz)", "Frame (us)",
+			"Hop (ms)", "Tone (us)", "Hop (ms)", "Load (%)");
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		float fs = rates[r];
+
+		float toneFs = fminf(fs, SPECTRUM_TONE_SAMPLE_RATE);
+
+		SPECTRUM_init(&state, &scratch, fs, toneFs);
+
+		double hop = 1e3 * state.hop / fs;
+		double toneHop = 1e3 * SPECTRUM_TONE_LENGTH / toneFs;
+
+		double frame = time_frame(fs, false);
+		double tone = SPECTRUM_TONES ? time_frame(fs, true) : 0.0;
+
+		double load = 0.1 * (frame / hop + tone / toneHop);
+
+		printf("%10.0f %12.2f %10.2f %12.2f %10.2f %8.3f\n", fs, frame, hop,
+				tone, toneHop, load);
+	}
+
+	return 0;
+}
@@ -0,0 +1,404 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        bench_spl.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host benchmark of the SPL pipeline, built for each engine.
+ *
+ *   bench_spl [results [reference]]
+ *
+ * prints the throughput, and with a results file the cost of the energy
+ * accumulators and the levels of the accuracy table, compared with the
+ * reference file of another engine. */
+#include "spl.h"
+#include "test.h"
+
+#define BLOCK_LENGTH                        1024
+#define BENCHMARK_SAMPLES                   (8 * 1024 * 1024)
+#define BENCHMARK_REPETITIONS               5
+
+#define SETTLING_TIME                       1.0f
+#define MEASUREMENT_TIME                    2.0f
+
+/* Signals of the accuracy table: frequency (a fraction of the sampling
+ * rate if negative), amplitude, offset and noise in LSB */
+#define NUMBER_OF_SIGNALS                   6
+
+static const double signals[NUMBER_OF_SIGNALS][4] = {
+	{ 31.5, 5.0, 300.0, 0.5 },
+	{ 1000.0, 5.0, 300.0, 0.5 },
+	{ 1000.0, 300.0, 0.0, 0.0 },
+	{ 1000.0, 30000.0, 0.0, 0.0 },
+	{ -0.4, 3000.0, 0.0, 0.0 },
+	{ 1000.0, 0.0, 300.0, 0.5 }
+};
+
+#define NUMBER_OF_RATES                     2
+
+static const float rates[NUMBER_OF_RATES] = { 48000.0f, 384000.0f };
+
+/* Results of an engine, levels of each rate, signal and weighting and
+ * time per sample of each rate of the throughput */
+#define NUMBER_OF_LEVELS                    (TEST_NUMBER_OF_SAMPLE_RATES * NUMBER_OF_SIGNALS * SPL_NUMBER_OF_WEIGHTINGS)
+
+typedef struct {
+	double levels[NUMBER_OF_LEVELS];
+	double times[NUMBER_OF_RATES];
+} results_t;
+
+static results_t results;
+static results_t reference;
+
+static spl_state_t state;
+static spl_scratch_t scratch;
+
+static int16_t buffer[BLOCK_LENGTH];
+
+/* Best time per sample in ns of the pipeline called with blocks of the
+ * length, a length of 1 is the cost of the per sample calls */
+static double time_pipeline(float fs, uint32_t length) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, 1000.0, 1000.0, 300.0, 2.0);
+	TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+
+	SPL_init_A_weighting_filter(&state, &scratch, fs);
+	SPL_find_calibration_offset(&state, 2);
+	SPL_init_compensation_filter(&state, fs);
+
+	double best = INFINITY;
+
+	for (uint32_t k = 0; k < BENCHMARK_REPETITIONS; k += 1) {
+
+		double start = TEST_seconds();
+
+		for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i += BLOCK_LENGTH) {
+			for (uint32_t j = 0; j < BLOCK_LENGTH; j += length) {
+				SPL_process_block(&state, buffer + j, length);
+			}
+		}
+
+		double time = (TEST_seconds() - start) / BENCHMARK_SAMPLES;
+
+		best = time < best ? time : best;
+	}
+
+	return 1e9 * best;
+}
+
+/* Largest difference in dB, infinite levels are equal if both are */
+static double level_error(double level, double referenceLevel) {
+
+	if (isinf(level) && isinf(referenceLevel) && level == referenceLevel) {
+		return 0.0;
+	}
+
+	double error = fabs(level - referenceLevel);
+
+	return isnan(error) ? INFINITY : error;
+}
+
+/* Running mean of the baseline, (n*mean + sum)/(n + m) in float with a
+ * 32 bit count, and the compensated sum that replaced it */
+typedef struct {
+	float mean;
+	uint32_t n;
+	double energy;
+	double energyCompensation;
+	uint64_t count;
+} accumulator_t;
+
+static void add_running_mean(accumulator_t *a, float sum, uint32_t n) {
+	a->mean = (a->n * a->mean + sum) / (a->n + n);
+	a->n += n;
+}
+
+static void add_compensated(accumulator_t *a, float sum, uint32_t n) {
+	double y = sum - a->energyCompensation;
+	double t = a->energy + y;
+	a->energyCompensation = (t - a->energy) - y;
+	a->energy = t;
+	a->count += n;
+}
+
+/* Best time per sample in ns of an accumulator fed with blocks of the
+ * length, the sums of the blocks are ready in a buffer */
+static double time_accumulator(void (*add)(accumulator_t*, float, uint32_t),
+		uint32_t length) {
+
+	static float sums[BLOCK_LENGTH];
+
+	for (uint32_t i = 0; i < BLOCK_LENGTH; i += 1) {
+		sums[i] = (float) (length * (1000.0 + i % 7));
+	}
+
+	double best = INFINITY;
+
+	for (uint32_t k = 0; k < BENCHMARK_REPETITIONS; k += 1) {
+
+		volatile accumulator_t a = { 0 };
+
+		uint32_t blocks = BENCHMARK_SAMPLES / length;
+
+		double start = TEST_seconds();
+
+		for (uint32_t i = 0; i < blocks; i += 1) {
+			add((accumulator_t*) &a, sums[i % BLOCK_LENGTH], length);
+		}
+
+		double time = (TEST_seconds() - start) / BENCHMARK_SAMPLES;
+
+		best = time < best ? time : best;
+	}
+
+	return 1e9 * best;
+}
+
+/* Error in dB of the mean of each accumulator after a day at 384 kHz of
+ * blocks with the same sum */
+static void day_of_blocks(double *errors) {
+
+	accumulator_t a = { 0 };
+
+	float sum = BLOCK_LENGTH * 1234.5f;
+
+	uint64_t blocks = (uint64_t) 24 * 3600 * 384000 / BLOCK_LENGTH;
+
+	for (uint64_t i = 0; i < blocks; i += 1) {
+		add_running_mean(&a, sum, BLOCK_LENGTH);
+		add_compensated(&a, sum, BLOCK_LENGTH);
+	}
+
+	double expected = sum / BLOCK_LENGTH;
+
+	errors[0] = level_error(10.0 * log10(a.mean), 10.0 * log10(expected));
+	errors[1] = level_error(10.0 * log10(a.energy / a.count),
+			10.0 * log10(expected));
+}
+
+/* LAeq of each hour of a day at 8 kHz of a repeated block of a tone with
+ * noise, the largest change from the first hour in dB */
+static double day_of_recording(void) {
+
+	float fs = 8000.0f;
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, 1000.0, 300.0, 300.0, 1.0);
+	TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+
+	SPL_init_A_weighting_filter(&state, &scratch, fs);
+	SPL_find_calibration_offset(&state, 2);
+	SPL_init_compensation_filter(&state, fs);
+
+	uint32_t blocksPerHour = 3600 * (uint32_t) fs / BLOCK_LENGTH;
+
+	double first = 0.0;
+	double change = 0.0;
+
+	for (uint32_t h = 0; h < 24; h += 1) {
+
+		for (uint32_t i = 0; i < blocksPerHour; i += 1) {
+			SPL_process_block(&state, buffer, BLOCK_LENGTH);
+		}
+
+		SPL_to_dB(&state);
+
+		if (h == 0) {
+			first = state.spl;
+		}
+
+		double error = level_error(state.spl, first);
+
+		change = error > change ? error : change;
+	}
+
+	return change;
+}
+
+/* Levels of a signal after the filters settle */
+static void measure(const double *parameters, float fs, double *levels) {
+
+	test_signal_t signal;
+
+	double frequency = parameters[0] < 0.0 ? -parameters[0] * fs :
+			parameters[0];
+
+	TEST_init_signal(&signal, frequency, parameters[1], parameters[2],
+			parameters[3]);
+
+	SPL_init_A_weighting_filter(&state, &scratch, fs);
+	SPL_find_calibration_offset(&state, 2);
+	SPL_init_compensation_filter(&state, fs);
+
+	uint32_t settling = (uint32_t) (SETTLING_TIME * fs);
+	uint32_t total = settling + (uint32_t) (MEASUREMENT_TIME * fs);
+
+	for (uint32_t i = 0; i < total; i += BLOCK_LENGTH) {
+
+		if (i == settling / BLOCK_LENGTH * BLOCK_LENGTH) {
+			for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+				state.energy[w] = 0.0;
+				state.energyCompensation[w] = 0.0;
+			}
+			state.n = 0;
+		}
+
+		TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+		SPL_process_block(&state, buffer, BLOCK_LENGTH);
+	}
+
+	SPL_to_dB(&state);
+
+	levels[SPL_WEIGHTING_A] = state.spl;
+	levels[SPL_WEIGHTING_C] = state.LCeq;
+	levels[SPL_WEIGHTING_Z] = state.LZeq;
+}
+
+/* Save or load the results as text, one value per line */
+static bool save_results(const char *filename, results_t *r) {
+
+	FILE *file = fopen(filename, "w");
+
+	if (file == NULL) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < NUMBER_OF_LEVELS; i += 1) {
+		fprintf(file, "%.6f\n", r->levels[i]);
+	}
+
+	for (uint32_t i = 0; i < NUMBER_OF_RATES; i += 1) {
+		fprintf(file, "%.6f\n", r->times[i]);
+	}
+
+	return fclose(file) == 0;
+}
+
+static bool load_results(const char *filename, results_t *r) {
+
+	FILE *file = fopen(filename, "r");
+
+	if (file == NULL) {
+		return false;
+	}
+
+	bool success = true;
+
+	for (uint32_t i = 0; i < NUMBER_OF_LEVELS; i += 1) {
+		success &= fscanf(file, "%lf", r->levels + i) == 1;
+	}
+
+	for (uint32_t i = 0; i < NUMBER_OF_RATES; i += 1) {
+		success &= fscanf(file, "%lf", r->times + i) == 1;
+	}
+
+	fclose(file);
+
+	return success;
+}
+
+int main(int argc, char **argv) {
+
+#if SPL_ENGINE == SPL_ENGINE_Q31
+	printf("Q31 engine");
+#elif SPL_ENGINE == SPL_ENGINE_FLOAT_DELTA
+	printf("Delta engine");
+#else
+	printf("Float engine");
+#endif
+	printf(", LAeq%s%s\n", SPL_LCEQ ? ", LCeq" : "", SPL_LZEQ ? ", LZeq" : "");
+
+	/* Throughput of the block pipeline */
+	printf("%10s %18s %18s %12s\n", "fs (Hz)", "1 (ns/sample)",
+			"1024 (ns/sample)", "Msamples/s");
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+		double single = time_pipeline(rates[r], 1);
+		double block = time_pipeline(rates[r], BLOCK_LENGTH);
+		printf("%10.0f %18.2f %18.2f %12.1f\n", rates[r], single, block,
+				1e3 / block);
+		results.times[r] = block;
+	}
+
+	/* The throughput alone without a results file */
+	if (argc < 2) {
+		return 0;
+	}
+
+	/* Cost and error of the energy accumulators */
+	printf("%10s %18s %18s\n", "Accumulator", "1 (ns/sample)",
+			"1024 (ns/sample)");
+	printf("%10s %18.2f %18.2f\n", "Mean", time_accumulator(add_running_mean, 1),
+			time_accumulator(add_running_mean, BLOCK_LENGTH));
+	printf("%10s %18.2f %18.2f\n", "Kahan", time_accumulator(add_compensated, 1),
+			time_accumulator(add_compensated, BLOCK_LENGTH));
+
+	double accumulatorErrors[2];
+	day_of_blocks(accumulatorErrors);
+
+	printf("Error after a day at 384 kHz (dB): mean %.2e, Kahan %.2e\n",
+			accumulatorErrors[0], accumulatorErrors[1]);
+	printf("Largest change of LAeq over a day at 8 kHz (dB): %.2e\n",
+			day_of_recording());
+
+	/* Levels of the accuracy table */
+	for (uint32_t r = 0; r < TEST_NUMBER_OF_SAMPLE_RATES; r += 1) {
+		for (uint32_t k = 0; k < NUMBER_OF_SIGNALS; k += 1) {
+			measure(signals[k], TEST_sampleRates[r], results.levels
+					+ (r * NUMBER_OF_SIGNALS + k) * SPL_NUMBER_OF_WEIGHTINGS);
+		}
+	}
+
+	if (!save_results(argv[1], &results)) {
+		printf("Could not write %s\n", argv[1]);
+		return 1;
+	}
+
+	if (argc < 3) {
+		return 0;
+	}
+
+	if (!load_results(argv[2], &reference)) {
+		printf("Could not read %s\n", argv[2]);
+		return 1;
+	}
+
+	/* Largest error of each weighting at each rate over the signals */
+	printf("Error against %s (dB)\n", argv[2]);
+	printf("%10s %8s %8s %8s\n", "fs (Hz)", "LAeq", "LCeq", "LZeq");
+
+	for (uint32_t r = 0; r < TEST_NUMBER_OF_SAMPLE_RATES; r += 1) {
+
+		double errors[SPL_NUMBER_OF_WEIGHTINGS] = { 0.0 };
+
+		for (uint32_t k = 0; k < NUMBER_OF_SIGNALS; k += 1) {
+			for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+				uint32_t i = (r * NUMBER_OF_SIGNALS + k)
+						* SPL_NUMBER_OF_WEIGHTINGS + w;
+				double error = level_error(results.levels[i],
+						reference.levels[i]);
+				errors[w] = error > errors[w] ? error : errors[w];
+			}
+		}
+
+		printf("%10.0f %8.3f %8.3f %8.3f\n", TEST_sampleRates[r],
+				errors[SPL_WEIGHTING_A], errors[SPL_WEIGHTING_C],
+				errors[SPL_WEIGHTING_Z]);
+	}
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+		printf("Speedup at %.0f Hz: %.2f\n", rates[r],
+				reference.times[r] / results.times[r]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        stubs.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* File system of the device on the host. The files are written to the
+ * working directory of the test. */
+#include <stdio.h>
+#include <string.h>
+
+#include "audioMoth.h"
+
+#define NUMBER_OF_AUXILIARY_FILES           4
+
+static FILE *file;
+
+static FILE *auxiliaryFiles[NUMBER_OF_AUXILIARY_FILES];
+
+bool AudioMoth_enableFileSystem() {
+	return true;
+}
+
+bool AudioMoth_openFile(char *filename) {
+	file = fopen(filename, "wb");
+	return file != NULL;
+}
+
+bool AudioMoth_openFileToRead(char *filename) {
+	file = fopen(filename, "rb");
+	return file != NULL;
+}
+
+bool AudioMoth_readFile(char *buffer, uint32_t bufferSize) {
+	memset(buffer, 0, bufferSize);
+	fread(buffer, 1, bufferSize, file);
+	return ferror(file) == 0;
+}
+
+bool AudioMoth_appendFile(char *filename) {
+	file = fopen(filename, "ab");
+	return file != NULL;
+}
+
+bool AudioMoth_writeToFile(void *bytes, uint16_t bytesToWrite) {
+	return fwrite(bytes, 1, bytesToWrite, file) == bytesToWrite;
+}
+
+bool AudioMoth_closeFile() {
+	return fclose(file) == 0;
+}
+
+bool AudioMoth_openAuxiliaryFile(uint32_t index, char *filename) {
+	auxiliaryFiles[index] = fopen(filename, "wb");
+	return auxiliaryFiles[index] != NULL;
+}
+
+bool AudioMoth_appendAuxiliaryFile(uint32_t index, char *filename) {
+	auxiliaryFiles[index] = fopen(filename, "ab");
+	return auxiliaryFiles[index] != NULL;
+}
+
+bool AudioMoth_writeToAuxiliaryFile(uint32_t index, void *bytes,
+		uint16_t bytesToWrite) {
+	return fwrite(bytes, 1, bytesToWrite, auxiliaryFiles[index])
+			== bytesToWrite;
+}
+
+bool AudioMoth_closeAuxiliaryFile(uint32_t index) {
+	return fclose(auxiliaryFiles[index]) == 0;
+}
@@ -0,0 +1,78 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        test.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host test helpers */
+#include <time.h>
+
+#include "test.h"
+
+const float TEST_sampleRates[TEST_NUMBER_OF_SAMPLE_RATES] = { 8000.0f,
+		16000.0f, 24000.0f, 32000.0f, 48000.0f, 96000.0f, 125000.0f,
+		192000.0f, 250000.0f, 256000.0f, 384000.0f };
+
+uint32_t testsRun;
+uint32_t testsFailed;
+
+/* Uniform deviate in (0, 1) from a xorshift generator */
+static double uniform(uint64_t *seed) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return ((*seed >> 11) + 0.5) / 9007199254740992.0;
+}
+
+void TEST_init_signal(test_signal_t *signal, double frequency,
+		double amplitude, double offset, double noise) {
+	signal->frequency = frequency;
+	signal->amplitude = amplitude;
+	signal->offset = offset;
+	signal->noise = noise;
+	signal->phase = 0.0;
+	signal->seed = 88172645463325252ULL;
+}
+
+void TEST_generate(test_signal_t *signal, float fs, int16_t *buffer,
+		uint32_t n) {
+
+	double increment = 2.0 * M_PI * signal->frequency / fs;
+
+	for (uint32_t i = 0; i < n; i += 1) {
+
+		double x = signal->offset + signal->amplitude * sin(signal->phase);
+
+		/* Box-Muller transform */
+		if (signal->noise > 0.0) {
+			double u1 = uniform(&signal->seed);
+			double u2 = uniform(&signal->seed);
+			x += signal->noise * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+		}
+
+		x = round(x);
+
+		buffer[i] = (int16_t) (x > INT16_MAX ? INT16_MAX :
+				x < INT16_MIN ? INT16_MIN : x);
+
+		signal->phase = fmod(signal->phase + increment, 2.0 * M_PI);
+	}
+}
+
+double TEST_seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+int TEST_report(const char *name) {
+	printf("%s: %u checks, %u failed\n", name, (unsigned int) testsRun,
+			(unsigned int) testsFailed);
+	return testsFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        test.h
+ *
+ * Description:  Helpers of the host tests and benchmarks: checks, test
+ *               signals and timing.
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+#ifndef TESTS_TEST_H_
+#define TESTS_TEST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <math.h>
+
+/* Sampling rates of the filter tables, the rates produced by the sample
+ * rates of the device and their dividers */
+#define TEST_NUMBER_OF_SAMPLE_RATES         11
+
+extern const float TEST_sampleRates[TEST_NUMBER_OF_SAMPLE_RATES];
+
+/* Check a condition and print the message if it fails */
+#define CHECK(condition, ...) do { \
+	testsRun += 1; \
+	if (!(condition)) { \
+		testsFailed += 1; \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+
+extern uint32_t testsRun;
+extern uint32_t testsFailed;
+
+/* Test signal, a tone plus an offset and gaussian noise in LSB */
+
+typedef struct {
+	double frequency;
+	double amplitude;
+	double offset;
+	double noise;
+	double phase;
+	uint64_t seed;
+} test_signal_t;
+
+/**
+ * Init a test signal.
+ *
+ * @param signal Test signal.
+ * @param frequency Frequency of the tone in Hz.
+ * @param amplitude Amplitude of the tone in LSB.
+ * @param offset Offset in LSB.
+ * @param noise Standard deviation of the noise in LSB.
+ */
+void TEST_init_signal(test_signal_t *signal, double frequency,
+		double amplitude, double offset, double noise);
+
+/**
+ * Generate the next samples of a test signal.
+ *
+ * The samples are rounded and clamped to the 16 bit range.
+ *
+ * @param signal Test signal.
+ * @param fs Sampling rate in Hz.
+ * @param buffer Destination samples.
+ * @param n Number of samples.
+ */
+void TEST_generate(test_signal_t *signal, float fs, int16_t *buffer,
+		uint32_t n);
+
+/**
+ * Read a monotonic clock.
+ *
+ * @return Time in seconds.
+ */
+double TEST_seconds(void);
+
+/**
+ * Print the result of the tests.
+ *
+ * @param name Name of the test program.
+ * @return Exit code of the test program.
+ */
+int TEST_report(const char *name);
+
+#endif /* TESTS_TEST_H_ */
@@ -0,0 +1,235 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        test_decimator.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host tests of the polyphase FIR decimator */
+#include <string.h>
+
+#include "decimator.h"
+#include "test.h"
+
+#define OUTPUT_RATE                         48000.0f
+#define OUTPUT_LENGTH                       4096
+#define SETTLING_LENGTH                     64
+#define BLOCK_LENGTH                        1024
+
+#define NUMBER_OF_DIVIDERS                  4
+
+static const uint32_t dividers[NUMBER_OF_DIVIDERS] = { 2, 4, 8, 16 };
+
+/* Attenuation of the bands that alias into the pass band in dB */
+static const double rejections[NUMBER_OF_DIVIDERS] = { 47.0, 49.0, 51.0,
+		52.0 };
+
+static decimator_state_t state;
+
+static int16_t input[DECIMATOR_HISTORY_LENGTH + OUTPUT_LENGTH
+		* DECIMATOR_MAX_DIVIDER];
+static int16_t output[OUTPUT_LENGTH];
+static int16_t reference[OUTPUT_LENGTH];
+
+/* Shift of the sum of divider samples for unit gain */
+static int8_t unit_gain_shift(uint32_t divider) {
+	int8_t shift = 0;
+	while ((1U << -shift) < divider) {
+		shift -= 1;
+	}
+	return shift;
+}
+
+/* Decimate a tone into output with unit gain, in blocks of the length */
+static void decimate_tone(uint32_t divider, double frequency,
+		double amplitude, uint32_t length) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, frequency, amplitude, 0.0, 0.0);
+
+	DECIMATOR_init(&state, divider, unit_gain_shift(divider));
+
+	int16_t *buffer = input + DECIMATOR_HISTORY_LENGTH;
+
+	for (uint32_t k = 0; k < OUTPUT_LENGTH; k += length / divider) {
+		TEST_generate(&signal, divider * OUTPUT_RATE, buffer, length);
+		DECIMATOR_copy_block(&state, buffer, length, output + k);
+	}
+}
+
+/* RMS of the output after the taps settle */
+static double output_rms(void) {
+	double sum = 0.0;
+	for (uint32_t i = SETTLING_LENGTH; i < OUTPUT_LENGTH; i += 1) {
+		sum += (double) output[i] * output[i];
+	}
+	return sqrt(sum / (OUTPUT_LENGTH - SETTLING_LENGTH));
+}
+
+/* Tones up to 0.4 times the output rate keep their level within 0.05 dB */
+static void test_pass_band(void) {
+
+	static const double fractions[] = { 0.01, 0.1, 0.25, 0.4 };
+
+	for (uint32_t d = 0; d < NUMBER_OF_DIVIDERS; d += 1) {
+		for (uint32_t k = 0; k < sizeof(fractions) / sizeof(fractions[0]);
+				k += 1) {
+
+			double amplitude = 10000.0;
+
+			decimate_tone(dividers[d], fractions[k] * OUTPUT_RATE, amplitude,
+					BLOCK_LENGTH);
+
+			double gain = 20.0 * log10(output_rms() * sqrt(2.0) / amplitude);
+
+			CHECK(fabs(gain) < 0.05,
+					"divider %u, %.0f Hz tone: gain %.3f dB",
+					(unsigned int) dividers[d], fractions[k] * OUTPUT_RATE,
+					gain);
+		}
+	}
+}
+
+/* Tones that alias into the pass band are attenuated by the documented
+ * rejection of the divider */
+static void test_alias_rejection(void) {
+
+	static const double offsets[] = { -0.4, -0.25, -0.1, 0.0, 0.1, 0.25,
+			0.4 };
+
+	for (uint32_t d = 0; d < NUMBER_OF_DIVIDERS; d += 1) {
+
+		uint32_t divider = dividers[d];
+
+		for (uint32_t m = 1; m <= divider / 2; m += 1) {
+			for (uint32_t k = 0; k < sizeof(offsets) / sizeof(offsets[0]);
+					k += 1) {
+
+				double frequency = (m + offsets[k]) * OUTPUT_RATE;
+
+				if (frequency >= 0.5 * divider * OUTPUT_RATE) {
+					continue;
+				}
+
+				double amplitude = 30000.0;
+
+				decimate_tone(divider, frequency, amplitude, BLOCK_LENGTH);
+
+				double rms = output_rms();
+
+				double attenuation = rms > 0.0 ? -20.0 * log10(rms
+						* sqrt(2.0) / amplitude) : INFINITY;
+
+				CHECK(attenuation >= rejections[d],
+						"divider %u, %.0f Hz tone: attenuation %.1f dB",
+						(unsigned int) divider, frequency, attenuation);
+			}
+		}
+	}
+}
+
+/* The output does not depend on the length of the blocks, and the block
+ * decimated in place matches the copy */
+static void test_blocks(void) {
+
+	for (uint32_t d = 0; d < NUMBER_OF_DIVIDERS; d += 1) {
+
+		uint32_t divider = dividers[d];
+
+		decimate_tone(divider, 1000.0, 10000.0, BLOCK_LENGTH);
+		memcpy(reference, output, sizeof(reference));
+
+		decimate_tone(divider, 1000.0, 10000.0, 16 * divider);
+
+		CHECK(memcmp(output, reference, sizeof(reference)) == 0,
+				"divider %u: blocks of %u samples differ",
+				(unsigned int) divider, (unsigned int) (16 * divider));
+
+		test_signal_t signal;
+
+		TEST_init_signal(&signal, 1000.0, 10000.0, 0.0, 0.0);
+
+		DECIMATOR_init(&state, divider, unit_gain_shift(divider));
+
+		int16_t *buffer = input + DECIMATOR_HISTORY_LENGTH;
+
+		bool same = true;
+
+		for (uint32_t k = 0; k < OUTPUT_LENGTH; k += BLOCK_LENGTH / divider) {
+			TEST_generate(&signal, divider * OUTPUT_RATE, buffer,
+					BLOCK_LENGTH);
+			int16_t *x = DECIMATOR_process_block(&state, buffer,
+					BLOCK_LENGTH);
+			same &= memcmp(x, reference + k,
+					BLOCK_LENGTH / divider * sizeof(int16_t)) == 0;
+		}
+
+		CHECK(same, "divider %u: the block decimated in place differs",
+				(unsigned int) divider);
+	}
+}
+
+/* A full scale square wave saturates without wrapping and the clamped
+ * samples are counted. Away from the edges the output follows the sign of
+ * the input. */
+static void test_full_scale(void) {
+
+	for (uint32_t d = 0; d < NUMBER_OF_DIVIDERS; d += 1) {
+
+		uint32_t divider = dividers[d];
+		uint32_t period = 128 * divider;
+
+		DECIMATOR_init(&state, divider, unit_gain_shift(divider));
+
+		int16_t *buffer = input + DECIMATOR_HISTORY_LENGTH;
+
+		bool wrapped = false;
+
+		for (uint32_t start = 0; start < 4 * period; start += BLOCK_LENGTH) {
+
+			for (uint32_t i = 0; i < BLOCK_LENGTH; i += 1) {
+				buffer[i] = (start + i) % period < period / 2 ? INT16_MAX :
+						INT16_MIN;
+			}
+
+			DECIMATOR_copy_block(&state, buffer, BLOCK_LENGTH, output);
+
+			/* Output i reads the input from divider * (i - 15) */
+			for (uint32_t i = 0; i < BLOCK_LENGTH / divider; i += 1) {
+				uint32_t phase = (start + i * divider) % period;
+				if (start >= period && phase >= 16 * divider
+						&& phase < period / 2 - divider) {
+					wrapped |= output[i] < 16384;
+				}
+			}
+		}
+
+		CHECK(!wrapped, "divider %u: full scale input wrapped",
+				(unsigned int) divider);
+
+		/* The ringing of the edges goes past the full scale */
+		CHECK(state.clipped > 0, "divider %u: no clipped samples counted",
+				(unsigned int) divider);
+
+		DECIMATOR_reset(&state);
+
+		CHECK(state.clipped == 0, "divider %u: reset kept the clipped count",
+				(unsigned int) divider);
+	}
+}
+
+int main(void) {
+
+	test_pass_band();
+	test_alias_rejection();
+	test_blocks();
+	test_full_scale();
+
+	return TEST_report("test_decimator");
+}
@@ -0,0 +1,149 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        test_octave.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host tests of the octave and third-octave band filter bank */
+#include "octave.h"
+#include "test.h"
+
+#define BLOCK_LENGTH                        1024
+#define SETTLING_TIME                       1.0f
+#define MEASUREMENT_TIME                    2.0f
+
+/* Rates of the SPL pipeline with the analysis decimator, and without it
+ * at the highest rates */
+#define NUMBER_OF_RATES                     7
+
+static const float rates[NUMBER_OF_RATES] = { 8000.0f, 16000.0f, 32000.0f,
+		48000.0f, 62500.0f, 96000.0f, 384000.0f };
+
+static spl_state_t spl;
+static spl_scratch_t scratch;
+static octave_state_t state;
+
+static int16_t buffer[BLOCK_LENGTH];
+
+/* Band levels and LZeq of a tone after the filters settle */
+static float measure(float fs, double frequency, double amplitude) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, frequency, amplitude, 0.0, 0.0);
+
+	SPL_init_A_weighting_filter(&spl, &scratch, fs);
+	SPL_find_calibration_offset(&spl, 2);
+	SPL_init_compensation_filter(&spl, fs);
+	OCTAVE_init_filter_bank(&state, fs);
+
+	uint32_t settling = (uint32_t) (SETTLING_TIME * fs) / BLOCK_LENGTH;
+	uint32_t total = settling + (uint32_t) (MEASUREMENT_TIME * fs)
+			/ BLOCK_LENGTH;
+
+	for (uint32_t i = 0; i < total; i += 1) {
+
+		if (i == settling) {
+			for (uint32_t b = 0; b < OCTAVE_MAX_BANDS; b += 1) {
+				state.energy[b] = 0.0;
+			}
+			for (uint32_t s = 0; s < OCTAVE_MAX_STAGES; s += 1) {
+				state.stages[s].n = 0;
+			}
+			for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+				spl.energy[w] = 0.0;
+				spl.energyCompensation[w] = 0.0;
+			}
+			spl.n = 0;
+		}
+
+		TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+		SPL_process_block(&spl, buffer, BLOCK_LENGTH);
+		OCTAVE_process_block(&state, buffer, BLOCK_LENGTH);
+	}
+
+	SPL_to_dB(&spl);
+	OCTAVE_to_dB(&state, &spl);
+
+	return spl.LZeq;
+}
+
+/* A tone at the centre of each band reads LZeq in the band, and at least
+ * 20 dB less in the bands an octave or more away */
+static void test_band_centres(void) {
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		float fs = rates[r];
+
+		OCTAVE_init_filter_bank(&state, fs);
+
+		uint32_t numberOfBands = state.numberOfBands;
+
+		CHECK(numberOfBands > 0, "%.0f Hz: no bands", fs);
+
+		for (uint32_t b = 0; b < numberOfBands; b += 1) {
+
+			OCTAVE_init_filter_bank(&state, fs);
+
+			double frequency = state.frequency[b];
+
+			float LZeq = measure(fs, frequency, 3000.0);
+
+			CHECK(fabsf(state.level[b] - LZeq) < 0.1f,
+					"%.0f Hz, %.1f Hz band: %.3f dB, LZeq %.3f dB", fs,
+					frequency, state.level[b], LZeq);
+
+			for (uint32_t j = 0; j < numberOfBands; j += 1) {
+				if (j + OCTAVE_BANDS_PER_OCTAVE <= b
+						|| j >= b + OCTAVE_BANDS_PER_OCTAVE) {
+					CHECK(state.level[j] < LZeq - 20.0f,
+							"%.0f Hz, %.1f Hz tone: %.1f Hz band %.1f dB, LZeq %.1f dB",
+							fs, frequency, state.frequency[j], state.level[j],
+							LZeq);
+				}
+			}
+		}
+	}
+}
+
+/* A tone near the Nyquist frequency of a stage does not alias into the
+ * bands of the next stage */
+static void test_aliasing(void) {
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		float fs = rates[r];
+
+		for (uint32_t k = 1; k <= 4; k += 1) {
+
+			double frequency = 0.45 * fs / (1 << (k - 1));
+
+			float LZeq = measure(fs, frequency, 3000.0);
+
+			/* Bands at the alias, an octave or more below the tone */
+			for (uint32_t j = 0; j < state.numberOfBands; j += 1) {
+				if (state.frequency[j] < 0.5 * frequency) {
+					CHECK(state.level[j] < LZeq - 50.0f,
+							"%.0f Hz, %.0f Hz tone: %.1f Hz band %.1f dB, LZeq %.1f dB",
+							fs, frequency, state.frequency[j], state.level[j],
+							LZeq);
+				}
+			}
+		}
+	}
+}
+
+int main(void) {
+
+	test_band_centres();
+	test_aliasing();
+
+	return TEST_report("test_octave");
+}
@@ -0,0 +1,476 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        test_spectrum.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host tests of the Welch spectrum and of the tone detector */
+#include <stdlib.h>
+#include <string.h>
+
+#include "spectrum.h"
+#include "test.h"
+
+#define BLOCK_LENGTH                        1024
+#define MEASUREMENT_TIME                    10.0f
+#define NOISE                               100.0
+
+#define LTSA_FILE                           "TEST.LTS"
+#define LTSA_TIME                           5
+
+/* Rates of the tone samples: the SPL pipeline at the device rates, halved
+ * while above SPECTRUM_TONE_SAMPLE_RATE */
+#define NUMBER_OF_RATES                     5
+
+static const float rates[NUMBER_OF_RATES] = { 8000.0f, 16000.0f, 31250.0f,
+		32000.0f, 48000.0f };
+
+#define NUMBER_OF_FREQUENCIES               5
+
+static const double frequencies[NUMBER_OF_FREQUENCIES] = { 100.0, 315.0,
+		1000.0, 4000.0, 10000.0 };
+
+static spectrum_scratch_t scratch;
+static spectrum_state_t state;
+
+static int16_t buffer[BLOCK_LENGTH];
+
+/* Criterion of the tone-to-noise ratio in dB */
+static double criterion(double frequency) {
+	return frequency < 1000.0 ? 8.0 + 8.33 * log10(1000.0 / frequency) : 8.0;
+}
+
+/* Tone-to-noise ratio in dB of a tone in the white noise, with the noise
+ * in the critical band */
+static double tone_to_noise(double frequency, double amplitude, float fs) {
+	double bandwidth = frequency < 500.0 ? 100.0 : 0.2 * frequency;
+	return 10.0 * log10(amplitude * amplitude / 2.0
+			/ (NOISE * NOISE * 2.0 * bandwidth / fs));
+}
+
+/* Feed a tone in white noise to the tone detector, processing each frame
+ * as the main loop does */
+static void detect(float fs, double frequency, double amplitude) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, frequency, amplitude, 200.0, NOISE);
+
+	SPECTRUM_init(&state, &scratch, fs, fs);
+
+	uint32_t blocks = (uint32_t) (MEASUREMENT_TIME * fs) / BLOCK_LENGTH;
+
+	for (uint32_t i = 0; i < blocks; i += 1) {
+		TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+		SPECTRUM_add_tone_samples(&state, buffer, BLOCK_LENGTH);
+		SPECTRUM_process_tones(&state);
+	}
+}
+
+/* Periods in which the bins within a bin of the frequency were tones,
+ * and their largest ratio */
+static uint32_t tone_periods(float fs, double frequency, float *ratio) {
+
+	uint32_t k = (uint32_t) lround(frequency * SPECTRUM_TONE_LENGTH / fs);
+
+	uint32_t periods = 0;
+
+	*ratio = 0.0f;
+
+	for (uint32_t j = k - 1; j <= k + 1; j += 1) {
+		periods += scratch.tonePeriods[j];
+		*ratio = fmaxf(*ratio, scratch.toneRatio[j]);
+	}
+
+	return periods;
+}
+
+/* Periods of all the bins */
+static uint32_t all_periods(void) {
+	uint32_t periods = 0;
+	for (uint32_t k = 0; k < SPECTRUM_TONE_BINS; k += 1) {
+		periods += scratch.tonePeriods[k];
+	}
+	return periods;
+}
+
+/* Tones 10 dB above the criterion are found in every period from 100 Hz,
+ * and tones 6 dB below are not. The largest ratio of the periods reads up
+ * to about 1 dB high. */
+static void test_tones(void) {
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		float fs = rates[r];
+
+		for (uint32_t f = 0; f < NUMBER_OF_FREQUENCIES; f += 1) {
+
+			double frequency = frequencies[f];
+
+			if (frequency > 0.4 * fs) {
+				continue;
+			}
+
+			double amplitude = NOISE * sqrt(2.0 * 2.0 * (frequency < 500.0 ?
+					100.0 : 0.2 * frequency) / fs)
+					* pow(10.0, (criterion(frequency) + 10.0) / 20.0);
+
+			detect(fs, frequency, amplitude);
+
+			float ratio;
+
+			uint32_t periods = tone_periods(fs, frequency, &ratio);
+
+			double expected = tone_to_noise(frequency, amplitude, fs);
+
+			CHECK(periods == state.numberOfTonePeriods
+					&& state.numberOfTonePeriods >= 8,
+					"%.0f Hz, %.0f Hz tone: found in %u of %u periods", fs,
+					frequency, (unsigned int) periods,
+					(unsigned int) state.numberOfTonePeriods);
+
+			CHECK(fabs(ratio - expected) < 1.5,
+					"%.0f Hz, %.0f Hz tone: ratio %.2f dB, expected %.2f dB",
+					fs, frequency, ratio, expected);
+
+			CHECK(all_periods() == periods,
+					"%.0f Hz, %.0f Hz tone: %u periods in other bins", fs,
+					frequency, (unsigned int) (all_periods() - periods));
+
+			detect(fs, frequency, amplitude * pow(10.0, -16.0 / 20.0));
+
+			CHECK(all_periods() == 0,
+					"%.0f Hz, %.0f Hz tone 6 dB below the criterion: %u periods",
+					fs, frequency, (unsigned int) all_periods());
+		}
+	}
+}
+
+/* A frame completed while the main loop has not read the previous one is
+ * dropped and counted, and the next is handed over */
+static void test_dropped_frames(void) {
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, 1000.0, 1000.0, 0.0, NOISE);
+
+	SPECTRUM_init(&state, &scratch, 48000.0f, 48000.0f);
+
+	for (uint32_t i = 0; i < 3 * SPECTRUM_TONE_LENGTH; i += BLOCK_LENGTH) {
+		TEST_generate(&signal, 48000.0f, buffer, BLOCK_LENGTH);
+		SPECTRUM_add_tone_samples(&state, buffer, BLOCK_LENGTH);
+	}
+
+	CHECK(state.toneFramesWritten == 1 && state.toneFramesDropped == 2,
+			"%u frames handed over and %u dropped, expected 1 and 2",
+			(unsigned int) state.toneFramesWritten,
+			(unsigned int) state.toneFramesDropped);
+
+	SPECTRUM_process_tones(&state);
+	SPECTRUM_process_tones(&state);
+
+	CHECK(state.toneFramesRead == 1 && state.framesInTonePeriod == 1,
+			"%u frames read and %u in the period, expected 1 and 1",
+			(unsigned int) state.toneFramesRead,
+			(unsigned int) state.framesInTonePeriod);
+
+	for (uint32_t i = 0; i < SPECTRUM_TONE_LENGTH; i += BLOCK_LENGTH) {
+		TEST_generate(&signal, 48000.0f, buffer, BLOCK_LENGTH);
+		SPECTRUM_add_tone_samples(&state, buffer, BLOCK_LENGTH);
+	}
+
+	CHECK(state.toneFramesWritten == 2 && state.toneFramesDropped == 2,
+			"%u frames handed over and %u dropped, expected 2 and 2",
+			(unsigned int) state.toneFramesWritten,
+			(unsigned int) state.toneFramesDropped);
+}
+
+/* The density of white noise is its variance over half the rate */
+static void test_noise_density(void) {
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		float fs = rates[r];
+
+		test_signal_t signal;
+
+		TEST_init_signal(&signal, 1000.0, 0.0, 0.0, NOISE);
+
+		SPECTRUM_init(&state, &scratch, fs, fs);
+
+		for (uint32_t i = 0; i < 1000 * SPECTRUM_LENGTH; i += BLOCK_LENGTH) {
+			TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+			SPECTRUM_process_block(&state, buffer, BLOCK_LENGTH);
+		}
+
+		double sum = 0.0;
+
+		for (uint32_t k = 1; k < SPECTRUM_BINS - 1; k += 1) {
+			sum += state.power[k];
+		}
+
+		double density = 2.0 * sum / (SPECTRUM_BINS - 2)
+				/ (state.numberOfFrames * fs * state.windowPower);
+
+		double error = 10.0 * log10(density / (NOISE * NOISE / (fs / 2.0)));
+
+		CHECK(fabs(error) < 0.1, "%.0f Hz: noise density error %.3f dB", fs,
+				error);
+	}
+}
+
+/* Header of the long-term spectral average file */
+
+#pragma pack(push, 1)
+
+typedef struct {
+	char id[4];
+	uint32_t time;
+	uint32_t sampleRate;
+	uint32_t hop;
+	uint32_t framesPerColumn;
+	uint32_t numberOfBands;
+	int16_t minimumLevel;
+	uint16_t levelStep;
+} ltsa_header_t;
+
+#pragma pack(pop)
+
+/* A tone at the centre of a band of the long-term spectral average is
+ * the largest band of every column, and the bands away from it read the
+ * density of the noise */
+static void test_ltsa(void) {
+
+	static const uint32_t bands[] = { 5, 20, 50 };
+
+	for (uint32_t r = 0; r < NUMBER_OF_RATES; r += 1) {
+
+		float fs = rates[r];
+
+		for (uint32_t b = 0; b < sizeof(bands) / sizeof(bands[0]); b += 1) {
+
+			double width = fs / 2.0 / SPECTRUM_LTSA_BANDS;
+
+			test_signal_t signal;
+
+			TEST_init_signal(&signal, (bands[b] + 0.5) * width, 10000.0, 0.0,
+					NOISE);
+
+			SPECTRUM_init(&state, &scratch, fs, fs);
+
+			CHECK(SPECTRUM_open_ltsa_file(&state, LTSA_FILE, 1234567890),
+					"could not open %s", LTSA_FILE);
+
+			for (uint32_t i = 0; i < LTSA_TIME * fs; i += BLOCK_LENGTH) {
+				TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+				SPECTRUM_process_block(&state, buffer, BLOCK_LENGTH);
+				SPECTRUM_write_ltsa(&state);
+			}
+
+			CHECK(SPECTRUM_close_ltsa_file(&state), "could not close %s",
+					LTSA_FILE);
+
+			FILE *file = fopen(LTSA_FILE, "rb");
+
+			ltsa_header_t header;
+			uint8_t columns[LTSA_TIME + 1][SPECTRUM_LTSA_BANDS];
+
+			size_t length = 0;
+
+			if (file != NULL && fread(&header, sizeof(header), 1, file) == 1) {
+				length = fread(columns, SPECTRUM_LTSA_BANDS, LTSA_TIME + 1,
+						file);
+			}
+
+			if (file != NULL) {
+				fclose(file);
+			}
+
+			uint32_t expected = state.numberOfFrames / state.framesPerColumn;
+
+			CHECK(length == expected && expected >= LTSA_TIME - 1,
+					"%.0f Hz: %u columns in the file, %u expected", fs,
+					(unsigned int) length, (unsigned int) expected);
+
+			if (length == 0) {
+				continue;
+			}
+
+			CHECK(memcmp(header.id, "SPLT", 4) == 0 && header.time == 1234567890
+					&& header.sampleRate == (uint32_t) fs
+					&& header.hop == state.hop
+					&& header.framesPerColumn == state.framesPerColumn
+					&& header.numberOfBands == SPECTRUM_LTSA_BANDS
+					&& header.minimumLevel == -15000 && header.levelStep == 50,
+					"%.0f Hz: header %.4s, %u, %u Hz, hop %u, %u frames, %u bands, %d, %u",
+					fs, header.id, (unsigned int) header.time,
+					(unsigned int) header.sampleRate,
+					(unsigned int) header.hop,
+					(unsigned int) header.framesPerColumn,
+					(unsigned int) header.numberOfBands,
+					(int) header.minimumLevel,
+					(unsigned int) header.levelStep);
+
+			/* Density of the noise relative to the square of the full
+			 * scale per Hz, in steps of the file */
+			double noise = (10.0 * log10(NOISE * NOISE / (fs / 2.0)
+					/ (SPECTRUM_FULL_SCALE * SPECTRUM_FULL_SCALE))
+					- SPECTRUM_LTSA_MIN_LEVEL) / SPECTRUM_LTSA_LEVEL_STEP;
+
+			for (uint32_t c = 0; c < length; c += 1) {
+
+				uint32_t largest = 0;
+
+				for (uint32_t i = 1; i < SPECTRUM_LTSA_BANDS; i += 1) {
+					largest = columns[c][i] > columns[c][largest] ? i :
+							largest;
+				}
+
+				CHECK(largest == bands[b],
+						"%.0f Hz, column %u: tone of the band %u in the band %u",
+						fs, (unsigned int) c, (unsigned int) bands[b],
+						(unsigned int) largest);
+
+				/* The bands of a column of about 16 frames at 8 kHz
+				 * spread about 0.5 dB, their mean much less. The first
+				 * band has the DC bin. */
+				double sum = 0.0;
+				uint32_t count = 0;
+
+				for (uint32_t i = 1; i < SPECTRUM_LTSA_BANDS; i += 1) {
+					if (abs((int) i - (int) bands[b]) > 1) {
+						CHECK(fabs(columns[c][i] - noise) <= 6.0,
+								"%.0f Hz, column %u, band %u: %u, noise %.1f",
+								fs, (unsigned int) c, (unsigned int) i,
+								(unsigned int) columns[c][i], noise);
+						sum += columns[c][i];
+						count += 1;
+					}
+				}
+
+				CHECK(fabs(sum / count - noise) <= 1.0,
+						"%.0f Hz, column %u: mean of the bands %.1f, noise %.1f",
+						fs, (unsigned int) c, sum / count, noise);
+			}
+		}
+	}
+
+	remove(LTSA_FILE);
+}
+
+#if SPECTRUM_INDICES
+
+/* Indices of a signal of LTSA_TIME * 2 seconds at 48 kHz. The noise of a
+ * gated signal steps from NOISE to 10 times NOISE every block, so
+ * consecutive frames differ. With a burst, the signal is off but for the
+ * first second. */
+static void indices(test_signal_t *signal, bool gated, bool burst,
+		float *values) {
+
+	float fs = 48000.0f;
+
+	double amplitude = signal->amplitude;
+	double noise = signal->noise;
+
+	SPECTRUM_init(&state, &scratch, fs, fs);
+
+	uint32_t blocks = (uint32_t) (2 * LTSA_TIME * fs) / BLOCK_LENGTH;
+
+	for (uint32_t i = 0; i < blocks; i += 1) {
+		if (gated) {
+			signal->noise = i % 2 == 0 ? noise : 10.0 * noise;
+		}
+		if (burst) {
+			bool on = i * BLOCK_LENGTH < fs;
+			signal->amplitude = on ? amplitude : 0.0;
+			signal->noise = on ? noise : 1.0;
+		}
+		TEST_generate(signal, fs, buffer, BLOCK_LENGTH);
+		SPECTRUM_process_block(&state, buffer, BLOCK_LENGTH);
+	}
+
+	SPECTRUM_to_indices(&state);
+
+	memcpy(values, state.indices, sizeof(state.indices));
+}
+
+/* A tone in the biophony or in the anthrophony sets the sign of NDSI and
+ * raises BI above the noise, noise spreads the spectral and the temporal
+ * entropies and a tone or a burst concentrates them, and the acoustic
+ * complexity grows with the changes between frames */
+static void test_indices(void) {
+
+	test_signal_t signal;
+
+	float noise[SPECTRUM_NUMBER_OF_INDICES];
+	float gated[SPECTRUM_NUMBER_OF_INDICES];
+	float biophony[SPECTRUM_NUMBER_OF_INDICES];
+	float anthrophony[SPECTRUM_NUMBER_OF_INDICES];
+	float burst[SPECTRUM_NUMBER_OF_INDICES];
+
+	TEST_init_signal(&signal, 1000.0, 0.0, 0.0, NOISE);
+	indices(&signal, false, false, noise);
+
+	TEST_init_signal(&signal, 1000.0, 0.0, 0.0, NOISE);
+	indices(&signal, true, false, gated);
+
+	TEST_init_signal(&signal, 4000.0, 10000.0, 0.0, 1.0);
+	indices(&signal, false, false, biophony);
+
+	TEST_init_signal(&signal, 1500.0, 10000.0, 0.0, 1.0);
+	indices(&signal, false, false, anthrophony);
+
+	TEST_init_signal(&signal, 1000.0, 0.0, 0.0, NOISE);
+	indices(&signal, false, true, burst);
+
+	CHECK(biophony[SPECTRUM_INDEX_NDSI] > 0.99f
+			&& anthrophony[SPECTRUM_INDEX_NDSI] < -0.99f
+			&& fabsf(noise[SPECTRUM_INDEX_NDSI]
+					- (9000.0f - 1000.0f) / (9000.0f + 1000.0f)) < 0.02f,
+			"NDSI %.3f with a biophony tone, %.3f with an anthrophony tone, %.3f with noise",
+			biophony[SPECTRUM_INDEX_NDSI], anthrophony[SPECTRUM_INDEX_NDSI],
+			noise[SPECTRUM_INDEX_NDSI]);
+
+	CHECK(biophony[SPECTRUM_INDEX_BI] > 2.0f * noise[SPECTRUM_INDEX_BI],
+			"BI %.2f with a biophony tone, %.2f with noise",
+			biophony[SPECTRUM_INDEX_BI], noise[SPECTRUM_INDEX_BI]);
+
+	CHECK(noise[SPECTRUM_INDEX_HF] > 0.95f
+			&& biophony[SPECTRUM_INDEX_HF] < 0.5f,
+			"Hf %.3f with noise, %.3f with a tone", noise[SPECTRUM_INDEX_HF],
+			biophony[SPECTRUM_INDEX_HF]);
+
+	CHECK(noise[SPECTRUM_INDEX_HT] > 0.99f
+			&& burst[SPECTRUM_INDEX_HT] < noise[SPECTRUM_INDEX_HT] - 0.2f,
+			"Ht %.3f with noise, %.3f with a burst", noise[SPECTRUM_INDEX_HT],
+			burst[SPECTRUM_INDEX_HT]);
+
+	CHECK(gated[SPECTRUM_INDEX_ACI] > 1.3f * noise[SPECTRUM_INDEX_ACI]
+			&& noise[SPECTRUM_INDEX_ACI] > 0.0f,
+			"ACI %.1f with gated noise, %.1f with noise",
+			gated[SPECTRUM_INDEX_ACI], noise[SPECTRUM_INDEX_ACI]);
+}
+
+#endif
+
+int main(void) {
+
+	test_tones();
+	test_dropped_frames();
+	test_noise_density();
+	test_ltsa();
+
+#if SPECTRUM_INDICES
+	test_indices();
+
+	return TEST_report("test_spectrum (indices)");
+#else
+	return TEST_report("test_spectrum");
+#endif
+}
@@ -0,0 +1,1171 @@
+/* ----------------------------------------------------------------------
+ * Copyright (C) 2020 Pablo Zinemanas. All rights reserved.
+ *
+ * $Date:        26. February 2020
+ * $Revision:    V1.0.0
+ *
+ * Project:      AudioMoth-Firmware-SPL
+ * Title:        test_spl.c
+ *
+ * pablo.zinemanas@upf.edu
+ * -------------------------------------------------------------------- */
+
+/* Host tests of the SPL pipeline, built for each engine */
+#include <stdlib.h>
+
+#include "spl.h"
+#include "test.h"
+
+#define BLOCK_LENGTH                        1024
+#define SETTLING_TIME                       1.0f
+#define MEASUREMENT_TIME                    1.0f
+
+/* Nominal A-weighting and tolerances of class 0 and class 1 in dB, an
+ * empty field has no lower limit */
+#define TOLERANCES_FILE                     "../notebooks/data/ANSI_tolerances.csv"
+#define TOLERANCES_LINE_LENGTH              128
+
+#define INTERVAL_FILE                       "TEST.LEQ"
+#define EVENT_FILE                          "TEST.EVT"
+#define MAX_EVENTS                          32
+
+#define ROLLUP_FILE                         "LDEN.log"
+#define CALIBRATION_FILE                    "TEST.CAL"
+#define EXPOSURE_FILE                       "DOSE.log"
+#define LOG_LINE_LENGTH                     128
+
+static spl_state_t state;
+static spl_scratch_t scratch;
+
+static int16_t buffer[BLOCK_LENGTH];
+
+/* Process a signal for a duration in seconds */
+static void process(test_signal_t *signal, float fs, float duration) {
+
+	uint32_t remaining = (uint32_t) (duration * fs);
+
+	while (remaining > 0) {
+		uint32_t n = remaining < BLOCK_LENGTH ? remaining : BLOCK_LENGTH;
+		TEST_generate(signal, fs, buffer, n);
+		SPL_process_block(&state, buffer, n);
+		remaining -= n;
+	}
+}
+
+/* Init the pipeline at a rate with the calibration offset of the gain 2 */
+static void start(float fs) {
+	SPL_init_A_weighting_filter(&state, &scratch, fs);
+	SPL_find_calibration_offset(&state, 2);
+	SPL_init_compensation_filter(&state, fs);
+}
+
+/* LAeq, LCeq and LZeq of a signal after the filters settle */
+static void measure(test_signal_t *signal, float fs, float *levels) {
+
+	start(fs);
+
+	process(signal, fs, SETTLING_TIME);
+
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_WEIGHTINGS; i += 1) {
+		state.energy[i] = 0.0;
+		state.energyCompensation[i] = 0.0;
+	}
+	state.n = 0;
+
+	process(signal, fs, MEASUREMENT_TIME);
+
+	SPL_to_dB(&state);
+
+	levels[SPL_WEIGHTING_A] = state.spl;
+	levels[SPL_WEIGHTING_C] = state.LCeq;
+	levels[SPL_WEIGHTING_Z] = state.LZeq;
+}
+
+/* The offset of the microphone does not change the levels of a quiet
+ * tone, and an offset alone reads far below the noise of the device */
+static void test_offset(void) {
+
+	static const double offsets[] = { 500.0, 1000.0, -2000.0 };
+
+	for (uint32_t r = 0; r < TEST_NUMBER_OF_SAMPLE_RATES; r += 1) {
+
+		float fs = TEST_sampleRates[r];
+
+		test_signal_t signal;
+		float reference[SPL_NUMBER_OF_WEIGHTINGS];
+		float levels[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, 10.0, 0.0, 0.0);
+		measure(&signal, fs, reference);
+
+		for (uint32_t k = 0; k < sizeof(offsets) / sizeof(offsets[0]); k += 1) {
+
+			TEST_init_signal(&signal, 1000.0, 10.0, offsets[k], 0.0);
+			measure(&signal, fs, levels);
+
+			for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+				CHECK(fabsf(levels[w] - reference[w]) < 0.05f,
+						"%.0f Hz, offset %.0f, weighting %u: %.2f dB, %.2f dB without the offset",
+						fs, offsets[k], (unsigned int) w, levels[w],
+						reference[w]);
+			}
+
+			TEST_init_signal(&signal, 1000.0, 0.0, offsets[k], 0.0);
+			measure(&signal, fs, levels);
+
+			for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+				CHECK(!(levels[w] > -20.0f),
+						"%.0f Hz, offset %.0f alone, weighting %u: %.2f dB",
+						fs, offsets[k], (unsigned int) w, levels[w]);
+			}
+		}
+	}
+}
+
+/* A loud low frequency tone with an offset reads the level of a tone 20 dB
+ * lower without the offset plus 20 dB */
+static void test_loud_low_frequency(void) {
+
+	static const double frequencies[] = { 10.0, 20.0, 50.0, 100.0, 1000.0 };
+
+	for (uint32_t r = 0; r < TEST_NUMBER_OF_SAMPLE_RATES; r += 1) {
+
+		float fs = TEST_sampleRates[r];
+
+		for (uint32_t k = 0; k < sizeof(frequencies) / sizeof(frequencies[0]);
+				k += 1) {
+
+			test_signal_t signal;
+			float reference[SPL_NUMBER_OF_WEIGHTINGS];
+			float levels[SPL_NUMBER_OF_WEIGHTINGS];
+
+			TEST_init_signal(&signal, frequencies[k], 3000.0, 0.0, 0.0);
+			measure(&signal, fs, reference);
+
+			TEST_init_signal(&signal, frequencies[k], 30000.0, 2000.0, 0.0);
+			measure(&signal, fs, levels);
+
+			for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+				CHECK(fabsf(levels[w] - reference[w] - 20.0f) < 0.05f,
+						"%.0f Hz, %.0f Hz tone, weighting %u: %.2f dB, %.2f dB expected",
+						fs, frequencies[k], (unsigned int) w, levels[w],
+						reference[w] + 20.0f);
+			}
+		}
+	}
+}
+
+/* A and C-weightings of IEC 61672 in dB */
+static double A_weighting(double f) {
+	double f2 = f * f;
+	double r = 12194.0 * 12194.0 * f2 * f2 / ((f2 + 20.6 * 20.6)
+			* sqrt((f2 + 107.7 * 107.7) * (f2 + 737.9 * 737.9))
+			* (f2 + 12194.0 * 12194.0));
+	return 20.0 * log10(r) + 2.0;
+}
+
+static double C_weighting(double f) {
+	double f2 = f * f;
+	double r = 12194.0 * 12194.0 * f2 / ((f2 + 20.6 * 20.6)
+			* (f2 + 12194.0 * 12194.0));
+	return 20.0 * log10(r) + 0.062;
+}
+
+/* Read a field of the tolerance file, -INFINITY if it is empty */
+static double read_field(char **line) {
+	char *end;
+	double value = strtod(*line, &end);
+	if (end == *line) {
+		value = -INFINITY;
+	}
+	*line = *end == ',' ? end + 1 : end;
+	return value;
+}
+
+/* The A and C-weightings relative to LZeq are within the class 0
+ * tolerances at the centre frequencies below the Nyquist frequency */
+static void test_weighting_tolerances(void) {
+
+	FILE *file = fopen(TOLERANCES_FILE, "r");
+
+	CHECK(file != NULL, "could not open %s", TOLERANCES_FILE);
+
+	if (file == NULL) {
+		return;
+	}
+
+	char line[TOLERANCES_LINE_LENGTH];
+
+	/* Header */
+	char *success = fgets(line, sizeof(line), file);
+
+	while (success != NULL && fgets(line, sizeof(line), file) != NULL) {
+
+		char *field = line;
+
+		double f = read_field(&field);
+		read_field(&field);
+		double upper = read_field(&field);
+		double lower = read_field(&field);
+
+		for (uint32_t r = 0; r < TEST_NUMBER_OF_SAMPLE_RATES; r += 1) {
+
+			float fs = TEST_sampleRates[r];
+
+			if (f >= fs / 2.0) {
+				continue;
+			}
+
+			test_signal_t signal;
+			float levels[SPL_NUMBER_OF_WEIGHTINGS];
+
+			TEST_init_signal(&signal, f, 3000.0, 0.0, 0.0);
+			measure(&signal, fs, levels);
+
+			double errorA = levels[SPL_WEIGHTING_A]
+					- levels[SPL_WEIGHTING_Z] - A_weighting(f);
+			double errorC = levels[SPL_WEIGHTING_C]
+					- levels[SPL_WEIGHTING_Z] - C_weighting(f);
+
+			CHECK(errorA <= upper && errorA >= lower,
+					"%.0f Hz, %.0f Hz tone: A-weighting error %.2f dB", fs, f,
+					errorA);
+			CHECK(errorC <= upper && errorC >= lower,
+					"%.0f Hz, %.0f Hz tone: C-weighting error %.2f dB", fs, f,
+					errorC);
+		}
+	}
+
+	fclose(file);
+}
+
+/* Response of the compensation filter relative to 1 kHz, two sections
+ * with the zero at 53.6 Hz and the pole at 7.64 Hz, and of the high pass
+ * of the Z-weighting, in dB */
+static double compensation(double f) {
+	double zero = 53.6 * 53.6;
+	double pole = 7.64 * 7.64;
+	double r = (f * f + zero) / (f * f + pole)
+			* (1000.0 * 1000.0 + pole) / (1000.0 * 1000.0 + zero);
+	return 20.0 * log10(r);
+}
+
+static double Z_weighting(double f) {
+	double cutoff = SPL_Z_WEIGHTING_CUTOFF;
+	return 10.0 * log10(f * f / (f * f + cutoff * cutoff));
+}
+
+/* The compensation filter is designed for any rate: a 1 kHz tone reads
+ * its level with the calibration offset, and the low frequencies follow
+ * the analog response. The rates include the rates of the device that
+ * are not in the filter tables. */
+static void test_compensation(void) {
+
+	static const float rates[] = { 8000.0f, 16000.0f, 24000.0f, 32000.0f,
+			37500.0f, 44100.0f, 48000.0f, 96000.0f, 125000.0f, 128000.0f,
+			192000.0f, 250000.0f, 256000.0f, 384000.0f };
+
+	static const double frequencies[] = { 31.5, 50.0, 100.0, 250.0 };
+
+	for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r += 1) {
+
+		float fs = rates[r];
+
+		test_signal_t signal;
+		float reference[SPL_NUMBER_OF_WEIGHTINGS];
+		float levels[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, 3000.0, 0.0, 0.0);
+		measure(&signal, fs, reference);
+
+		double expected = 20.0 * log10(3000.0 / sqrt(2.0)
+				/ SPL_INPUT_NORMALIZATION) + CALdBA_med + Z_weighting(1000.0);
+
+		CHECK(fabs(reference[SPL_WEIGHTING_Z] - expected) < 0.01,
+				"%.0f Hz, 1000 Hz tone: %.3f dB, %.3f dB expected", fs,
+				reference[SPL_WEIGHTING_Z], expected);
+
+		for (uint32_t k = 0; k < sizeof(frequencies) / sizeof(frequencies[0]);
+				k += 1) {
+
+			double f = frequencies[k];
+
+			TEST_init_signal(&signal, f, 3000.0, 0.0, 0.0);
+			measure(&signal, fs, levels);
+
+			double response = levels[SPL_WEIGHTING_Z]
+					- reference[SPL_WEIGHTING_Z];
+
+			expected = compensation(f) + Z_weighting(f) - Z_weighting(1000.0);
+
+			CHECK(fabs(response - expected) < 0.02,
+					"%.0f Hz, %.1f Hz tone: %.3f dB, %.3f dB expected", fs, f,
+					response, expected);
+		}
+	}
+}
+
+/* The weightings are 0 dB at 1 kHz at every rate, so the calibration
+ * offset of the A-weighting holds for LCeq and LZeq */
+static void test_calibration_reference(void) {
+
+	for (uint32_t r = 0; r < TEST_NUMBER_OF_SAMPLE_RATES; r += 1) {
+
+		float fs = TEST_sampleRates[r];
+
+		test_signal_t signal;
+		float levels[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, 3000.0, 0.0, 0.0);
+		measure(&signal, fs, levels);
+
+		float reference = levels[SPL_WEIGHTING_Z] - Z_weighting(1000.0);
+
+		CHECK(fabsf(levels[SPL_WEIGHTING_A] - reference) < 0.005f,
+				"%.0f Hz, 1000 Hz tone: LAeq %.4f dB, LZeq %.4f dB", fs,
+				levels[SPL_WEIGHTING_A], reference);
+		CHECK(fabsf(levels[SPL_WEIGHTING_C] - reference) < 0.005f,
+				"%.0f Hz, 1000 Hz tone: LCeq %.4f dB, LZeq %.4f dB", fs,
+				levels[SPL_WEIGHTING_C], reference);
+	}
+}
+
+/* The energy of a day at 384 kHz keeps the level of a steady signal. The
+ * first 24 hours less a second are loaded in the sums with the mean
+ * square of the signal, and the last second is processed. */
+static void test_long_integration(void) {
+
+	float fs = 384000.0f;
+
+	test_signal_t signal;
+	float reference[SPL_NUMBER_OF_WEIGHTINGS];
+
+	TEST_init_signal(&signal, 1000.0, 300.0, 0.0, 1.0);
+	measure(&signal, fs, reference);
+
+	uint64_t day = (uint64_t) (24 * 3600 - 1) * (uint64_t) fs;
+
+	for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+		double mean = state.energy[w] / (double) state.n;
+		state.energy[w] = mean * (double) day;
+		state.energyCompensation[w] = 0.0;
+	}
+	state.n = day;
+
+	process(&signal, fs, MEASUREMENT_TIME);
+
+	SPL_to_dB(&state);
+
+	float levels[] = { state.spl, state.LCeq, state.LZeq };
+
+	CHECK(state.n == day + (uint64_t) fs, "count of the samples of a day");
+
+	for (uint32_t w = 0; w < SPL_NUMBER_OF_WEIGHTINGS; w += 1) {
+		CHECK(fabsf(levels[w] - reference[w]) < 0.0001f,
+				"weighting %u after a day: %.5f dB, %.5f dB in a second",
+				(unsigned int) w, levels[w], reference[w]);
+	}
+}
+
+/* The gain steps up when L90 is below SPL_AUTO_GAIN_MIN_L90 relative to
+ * the square of the full scale, and not 2 dB above it, in every engine */
+static void test_next_gain(void) {
+
+	static const double offsets[] = { -2.0, 2.0 };
+
+	for (uint32_t k = 0; k < 2; k += 1) {
+
+		float fs = 48000.0f;
+
+		double level = SPL_AUTO_GAIN_MIN_L90 + offsets[k];
+
+		/* Mean square relative to the square of the full scale */
+		double amplitude = SPL_TRUE_PEAK_FULL_SCALE * sqrt(2.0)
+				* pow(10.0, level / 20.0);
+
+		test_signal_t signal;
+		float levels[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, amplitude, 0.0, 0.0);
+		measure(&signal, fs, levels);
+
+		state.samplePeak = (uint32_t) amplitude;
+
+		uint32_t gain = SPL_find_next_gain(&state, 2);
+
+		CHECK(gain == (offsets[k] < 0.0 ? 3 : 2),
+				"1000 Hz tone at %.1f dB relative to the full scale: gain %u",
+				level, (unsigned int) gain);
+	}
+}
+
+/* Maximum of an exponential detector with a time constant for a tone
+ * burst of a duration after a tone 40 dB lower, relative to the level of
+ * the burst */
+static double burst_response(double duration, double tau) {
+	double decay = exp(-duration / tau);
+	return 10.0 * log10(1.0 - decay + 1e-4 * decay);
+}
+
+/* The Fast, Slow and Impulse levels of a steady tone settle to its LAeq,
+ * and their maxima for a tone burst follow the time constants. The
+ * bursts start and end at the updates of the detectors. */
+static void test_time_weighting(void) {
+
+	static const float rates[] = { 8000.0f, 48000.0f, 62500.0f };
+
+	static const double durations[] = { 0.2, 0.5, 0.02 };
+	static const double taus[] = { SPL_TAU_FAST, SPL_TAU_SLOW,
+			SPL_TAU_IMPULSE_RISE };
+
+	for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r += 1) {
+
+		float fs = rates[r];
+
+		test_signal_t signal;
+		float reference[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, 10000.0, 0.0, 0.0);
+		measure(&signal, fs, reference);
+
+		float steady[] = { state.LAFmax, state.LASmax, state.LAImax,
+				state.LAFmin };
+
+		for (uint32_t k = 0; k < sizeof(steady) / sizeof(steady[0]); k += 1) {
+			CHECK(fabsf(steady[k] - reference[SPL_WEIGHTING_A]) < 0.1f,
+					"%.0f Hz, steady tone: detector %u at %.2f dB, LAeq %.2f dB",
+					fs, (unsigned int) k, steady[k],
+					reference[SPL_WEIGHTING_A]);
+		}
+
+		for (uint32_t d = 0; d < sizeof(durations) / sizeof(durations[0]);
+				d += 1) {
+
+			TEST_init_signal(&signal, 1000.0, 100.0, 0.0, 0.0);
+
+			start(fs);
+
+			process(&signal, fs, SETTLING_TIME);
+
+			signal.amplitude = 10000.0;
+			process(&signal, fs, durations[d]);
+
+			signal.amplitude = 100.0;
+			process(&signal, fs, 0.5f);
+
+			SPL_to_dB(&state);
+
+			float maxima[] = { state.LAFmax, state.LASmax, state.LAImax };
+
+			double expected = reference[SPL_WEIGHTING_A]
+					+ burst_response(durations[d], taus[d]);
+
+			CHECK(fabs(maxima[d] - expected) < 0.1,
+					"%.0f Hz, %.0f ms burst: detector %u at %.2f dB, %.2f dB expected",
+					fs, 1000.0 * durations[d], (unsigned int) d, maxima[d],
+					expected);
+
+			CHECK(fabsf(state.LAFmin - reference[SPL_WEIGHTING_A] + 40.0f) < 0.1f,
+					"%.0f Hz, %.0f ms burst: LAFmin %.2f dB, %.2f dB expected",
+					fs, 1000.0 * durations[d], state.LAFmin,
+					reference[SPL_WEIGHTING_A] - 40.0f);
+		}
+	}
+}
+
+/* Header of the short interval Leq file */
+
+#pragma pack(push, 1)
+
+typedef struct {
+	char id[4];
+	uint32_t time;
+	uint32_t sampleRate;
+	uint32_t intervalDuration;
+} interval_header_t;
+
+#pragma pack(pop)
+
+/* The interval file has the header and the level of each second of a
+ * steady tone, also at 62.5 kHz where the periods are not all of the same
+ * length. Without writes the ring buffer keeps the first
+ * SPL_INTERVAL_BUFFER_LENGTH intervals and counts the others. */
+static void test_intervals(void) {
+
+	static const float rates[] = { 48000.0f, 62500.0f };
+
+	static const uint32_t seconds[] = { 10, SPL_INTERVAL_BUFFER_LENGTH + 6 };
+
+	for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r += 1) {
+
+		float fs = rates[r];
+
+		test_signal_t signal;
+		float reference[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, 3000.0, 0.0, 0.0);
+		measure(&signal, fs, reference);
+
+		for (uint32_t k = 0; k < sizeof(seconds) / sizeof(seconds[0]); k += 1) {
+
+			bool writes = k == 0;
+
+			start(fs);
+
+			CHECK(SPL_open_interval_file(&state, INTERVAL_FILE, 1234567890),
+					"could not open %s", INTERVAL_FILE);
+
+			for (uint32_t i = 0; i < seconds[k]; i += 1) {
+				process(&signal, fs, 1.0f);
+				if (writes) {
+					SPL_write_intervals(&state);
+				}
+			}
+
+			uint32_t completed = state.intervalWriteIndex;
+			uint32_t dropped = state.intervalsDropped;
+
+			CHECK(SPL_close_interval_file(&state), "could not close %s",
+					INTERVAL_FILE);
+
+			uint32_t expected = writes ? seconds[k] :
+					SPL_INTERVAL_BUFFER_LENGTH;
+
+			CHECK(completed == expected && dropped == seconds[k] - expected,
+					"%.0f Hz, %u s: %u intervals, %u dropped", fs,
+					(unsigned int) seconds[k], (unsigned int) completed,
+					(unsigned int) dropped);
+
+			FILE *file = fopen(INTERVAL_FILE, "rb");
+
+			interval_header_t header;
+			int16_t levels[SPL_INTERVAL_BUFFER_LENGTH + 1];
+
+			size_t length = 0;
+
+			if (file != NULL && fread(&header, sizeof(header), 1, file) == 1) {
+				length = fread(levels, sizeof(int16_t),
+						SPL_INTERVAL_BUFFER_LENGTH + 1, file);
+			}
+
+			if (file != NULL) {
+				fclose(file);
+			}
+
+			CHECK(length == expected, "%.0f Hz, %u s: %u levels in the file",
+					fs, (unsigned int) seconds[k], (unsigned int) length);
+
+			if (length == 0) {
+				continue;
+			}
+
+			CHECK(memcmp(header.id, "SPLI", 4) == 0 && header.time == 1234567890
+					&& header.sampleRate == (uint32_t) fs
+					&& header.intervalDuration == SPL_INTERVAL_DURATION,
+					"%.0f Hz: header %.4s, %u, %u Hz, %u ms", fs, header.id,
+					(unsigned int) header.time,
+					(unsigned int) header.sampleRate,
+					(unsigned int) header.intervalDuration);
+
+			/* The first interval has the transients of the filters */
+			for (uint32_t i = 1; i < length; i += 1) {
+				CHECK(abs(levels[i] - (int) lroundf(100.0f
+						* reference[SPL_WEIGHTING_A])) <= 2,
+						"%.0f Hz, interval %u: %.2f dB, LAeq %.2f dB", fs,
+						(unsigned int) i, levels[i] / 100.0f,
+						reference[SPL_WEIGHTING_A]);
+			}
+		}
+	}
+
+	remove(INTERVAL_FILE);
+}
+
+/* Level of a bin of the histogram */
+static float bin_level(uint32_t bin) {
+	return SPL_HISTOGRAM_MIN_LEVEL + (bin + 0.5f) * SPL_HISTOGRAM_BIN_WIDTH;
+}
+
+/* The statistical levels are the bins exceeded in 10, 50, 90 and 95 % of
+ * the intervals, SPL_HISTOGRAM_MIN_LEVEL without intervals, the level of
+ * a steady tone, and the first bin for silence */
+static void test_statistical_levels(void) {
+
+	float fs = 48000.0f;
+
+	start(fs);
+
+	SPL_to_dB(&state);
+
+	float levels[] = { state.L10, state.L50, state.L90, state.L95 };
+
+	for (uint32_t k = 0; k < sizeof(levels) / sizeof(levels[0]); k += 1) {
+		CHECK(levels[k] == SPL_HISTOGRAM_MIN_LEVEL,
+				"level %u without intervals: %.2f dB", (unsigned int) k,
+				levels[k]);
+	}
+
+	/* One interval in each of 100 consecutive bins */
+	for (uint32_t i = 0; i < 100; i += 1) {
+		scratch.histogram[300 + i] = 1;
+	}
+	state.histogramCount = 100;
+
+	SPL_to_dB(&state);
+
+	CHECK(state.L10 == bin_level(389) && state.L50 == bin_level(349)
+			&& state.L90 == bin_level(309) && state.L95 == bin_level(304),
+			"levels of 100 bins: %.2f %.2f %.2f %.2f dB", state.L10,
+			state.L50, state.L90, state.L95);
+
+	test_signal_t signal;
+	float reference[SPL_NUMBER_OF_WEIGHTINGS];
+
+	TEST_init_signal(&signal, 1000.0, 3000.0, 0.0, 0.0);
+	measure(&signal, fs, reference);
+
+	float steady[] = { state.L10, state.L50, state.L90, state.L95 };
+
+	CHECK(state.histogramCount == (uint32_t) ((SETTLING_TIME
+			+ MEASUREMENT_TIME - SPL_DETECTOR_SETTLING_TIME) * 1000.0f
+			/ SPL_HISTOGRAM_INTERVAL_DURATION),
+			"%u intervals in the histogram",
+			(unsigned int) state.histogramCount);
+
+	for (uint32_t k = 0; k < sizeof(steady) / sizeof(steady[0]); k += 1) {
+		CHECK(fabsf(steady[k] - reference[SPL_WEIGHTING_A])
+				<= SPL_HISTOGRAM_BIN_WIDTH,
+				"level %u of a steady tone: %.2f dB, LAeq %.2f dB",
+				(unsigned int) k, steady[k], reference[SPL_WEIGHTING_A]);
+	}
+
+	TEST_init_signal(&signal, 1000.0, 0.0, 0.0, 0.0);
+	measure(&signal, fs, reference);
+
+	CHECK(state.L10 == bin_level(0) && state.L95 == bin_level(0),
+			"levels of silence: %.2f %.2f dB", state.L10, state.L95);
+}
+
+/* LCpeak of a tone is its LCeq plus 3 dB, without a click in the
+ * settling of the filters. The true peak of a tone at a quarter of the
+ * rate, sampled 45 degrees from its peaks, is its amplitude, 3 dB above
+ * the largest sample. */
+static void test_peaks(void) {
+
+	static const float rates[] = { 8000.0f, 48000.0f, 62500.0f, 384000.0f };
+
+	for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r += 1) {
+
+		float fs = rates[r];
+
+		test_signal_t signal;
+		float reference[SPL_NUMBER_OF_WEIGHTINGS];
+
+		TEST_init_signal(&signal, 1000.0, 3000.0, 0.0, 0.0);
+		measure(&signal, fs, reference);
+
+		CHECK(fabsf(state.LCpeak - reference[SPL_WEIGHTING_C] - 3.01f) < 0.1f,
+				"%.0f Hz: LCpeak %.2f dB, LCeq %.2f dB", fs, state.LCpeak,
+				reference[SPL_WEIGHTING_C]);
+
+		/* A full scale click in the first block */
+		start(fs);
+
+		TEST_init_signal(&signal, 1000.0, 3000.0, 0.0, 0.0);
+		TEST_generate(&signal, fs, buffer, BLOCK_LENGTH);
+
+		buffer[BLOCK_LENGTH / 2] = INT16_MAX;
+
+		SPL_process_block(&state, buffer, BLOCK_LENGTH);
+
+		process(&signal, fs, SETTLING_TIME);
+
+		SPL_to_dB(&state);
+
+		CHECK(fabsf(state.LCpeak - reference[SPL_WEIGHTING_C] - 3.01f) < 0.1f,
+				"%.0f Hz, click in the settling: LCpeak %.2f dB, LCeq %.2f dB",
+				fs, state.LCpeak, reference[SPL_WEIGHTING_C]);
+
+#if SPL_TRUE_PEAK
+
+		double amplitude = 16384.0;
+
+		TEST_init_signal(&signal, fs / 4.0, amplitude, 0.0, 0.0);
+		signal.phase = PI / 4.0;
+
+		start(fs);
+		process(&signal, fs, 0.1f);
+		SPL_to_dB(&state);
+
+		double expected = 20.0 * log10(amplitude / SPL_TRUE_PEAK_FULL_SCALE);
+
+		CHECK(fabs(state.dBTP - expected) < 0.2,
+				"%.0f Hz, tone at a quarter of the rate: %.2f dBTP, %.2f dBTP expected",
+				fs, state.dBTP, expected);
+
+		TEST_init_signal(&signal, 1000.0, amplitude, 0.0, 0.0);
+
+		start(fs);
+		process(&signal, fs, 0.1f);
+		SPL_to_dB(&state);
+
+		CHECK(fabs(state.dBTP - expected) < 0.05,
+				"%.0f Hz, 1000 Hz tone: %.2f dBTP, %.2f dBTP expected", fs,
+				state.dBTP, expected);
+
+#endif
+	}
+}
+
+/* Amplitude of a 1 kHz tone of a level with the calibration offset of
+ * the gain 2 */
+static double tone_amplitude(float level) {
+	return sqrt(2.0) * SPL_INPUT_NORMALIZATION
+			* pow(10.0, (level - state.cal_offset) / 20.0);
+}
+
+/* Record segments of a 1 kHz tone of levels in dB and durations in
+ * seconds into a new event file, and read the events */
+static uint32_t record_events(float fs, const float *levels,
+		const float *durations, uint32_t segments, bool writes,
+		spl_event_t *events) {
+
+	remove(EVENT_FILE);
+
+	start(fs);
+
+	CHECK(SPL_open_event_file(&state, EVENT_FILE, 1234567890),
+			"could not open %s", EVENT_FILE);
+
+	test_signal_t signal;
+
+	TEST_init_signal(&signal, 1000.0, 0.0, 0.0, 0.0);
+
+	for (uint32_t i = 0; i < segments; i += 1) {
+		signal.amplitude = tone_amplitude(levels[i]);
+		process(&signal, fs, durations[i]);
+		if (writes) {
+			SPL_write_events(&state);
+		}
+	}
+
+	CHECK(SPL_close_event_file(&state), "could not close %s", EVENT_FILE);
+
+	FILE *file = fopen(EVENT_FILE, "rb");
+
+	uint32_t n = 0;
+
+	if (file != NULL) {
+		n = (uint32_t) fread(events, sizeof(spl_event_t), MAX_EVENTS, file);
+		fclose(file);
+	}
+
+	remove(EVENT_FILE);
+
+	return n;
+}
+
+/* An event starts when the Fast level exceeds the threshold and ends
+ * when it falls SPL_EVENT_HYSTERESIS dB below it, with the offset and the
+ * duration in ms, LAmax and SEL in hundredths of dB. A dip that stays
+ * within the hysteresis does not split the event, a deeper one does, and
+ * an event shorter than SPL_EVENT_MIN_DURATION is not kept. Without
+ * writes the ring buffer keeps the first SPL_EVENT_BUFFER_LENGTH events
+ * and counts the others. */
+static void test_events(void) {
+
+	static const float rates[] = { 48000.0f, 62500.0f };
+
+	float loud = SPL_EVENT_THRESHOLD + 10.0f;
+	float quiet = SPL_EVENT_THRESHOLD - 20.0f;
+
+	spl_event_t events[MAX_EVENTS];
+
+	for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r += 1) {
+
+		float fs = rates[r];
+
+		float levels[] = { quiet, loud, quiet };
+		float durations[] = { 1.0f, 2.0f, 1.5f };
+
+		uint32_t n = record_events(fs, levels, durations, 3, true, events);
+
+		/* Times of the crossings of the thresholds by the Fast level */
+		double background = pow(10.0, (quiet - loud) / 10.0);
+		double rise = SPL_TAU_FAST * log((1.0 - background)
+				/ (1.0 - pow(10.0, (SPL_EVENT_THRESHOLD - loud) / 10.0)));
+		double fall = SPL_TAU_FAST * log(pow(10.0,
+				(loud - SPL_EVENT_THRESHOLD + SPL_EVENT_HYSTERESIS) / 10.0));
+
+		double offset = 1000.0 * (durations[0] + rise);
+		double duration = 1000.0 * (durations[1] - rise + fall);
+		double SEL = loud + 10.0 * log10(durations[1] - rise);
+
+		CHECK(n == 1, "%.0f Hz: %u events, 1 expected", fs, (unsigned int) n);
+
+		if (n == 1) {
+			CHECK(events[0].time == 1234567890
+					&& fabs(events[0].offset - offset) <= 2.0
+					&& fabs(events[0].duration - duration) <= 2.0,
+					"%.0f Hz: event at %u + %u ms for %u ms, %.0f ms for %.0f ms expected",
+					fs, (unsigned int) events[0].time,
+					(unsigned int) events[0].offset,
+					(unsigned int) events[0].duration, offset, duration);
+
+			CHECK(abs(events[0].LAmax - (int) lroundf(100.0f * loud)) <= 5
+					&& fabs(events[0].SEL - 100.0 * SEL) <= 5.0,
+					"%.0f Hz: LAmax %.2f dB and SEL %.2f dB, %.2f and %.2f dB expected",
+					fs, events[0].LAmax / 100.0f, events[0].SEL / 100.0f,
+					loud, SEL);
+		}
+
+		/* A dip within the hysteresis and a deeper one */
+		float dips[] = { SPL_EVENT_THRESHOLD - 0.5f * SPL_EVENT_HYSTERESIS,
+				SPL_EVENT_THRESHOLD - 2.0f * SPL_EVENT_HYSTERESIS };
+
+		for (uint32_t k = 0; k < 2; k += 1) {
+
+			float dipLevels[] = { quiet, loud, dips[k], loud, quiet };
+			float dipDurations[] = { 1.0f, 1.5f, 1.0f, 1.5f, 1.0f };
+
+			n = record_events(fs, dipLevels, dipDurations, 5, true, events);
+
+			CHECK(n == k + 1, "%.0f Hz, dip to %.1f dB: %u events", fs,
+					dips[k], (unsigned int) n);
+		}
+
+		/* An event shorter than the minimum duration */
+		float shortDurations[] = { 1.0f, 0.5f, 1.0f };
+
+		n = record_events(fs, levels, shortDurations, 3, true, events);
+
+		CHECK(n == 0, "%.0f Hz, 500 ms burst: %u events", fs,
+				(unsigned int) n);
+	}
+
+	/* More events than the ring buffer without writes */
+	float levels[2 * (SPL_EVENT_BUFFER_LENGTH + 4) + 1];
+	float durations[2 * (SPL_EVENT_BUFFER_LENGTH + 4) + 1];
+
+	for (uint32_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i += 1) {
+		levels[i] = i % 2 == 0 ? quiet : loud;
+		durations[i] = 1.5f;
+	}
+
+	uint32_t n = record_events(8000.0f, levels, durations,
+			sizeof(levels) / sizeof(levels[0]), false, events);
+
+	CHECK(n == SPL_EVENT_BUFFER_LENGTH && state.eventsDropped == 4,
+			"%u events in the file and %u dropped", (unsigned int) n,
+			(unsigned int) state.eventsDropped);
+}
+
+/* Read the last line of a log file, false if it has none */
+static bool read_last_line(const char *filename, char *line) {
+
+	FILE *file = fopen(filename, "r");
+
+	bool found = false;
+
+	char next[LOG_LINE_LENGTH];
+
+	while (file != NULL && fgets(next, sizeof(next), file) != NULL) {
+		strcpy(line, next);
+		found = true;
+	}
+
+	if (file != NULL) {
+		fclose(file);
+	}
+
+	return found;
+}
+
+/* Add a recording of a level from an hour of a day to the day levels */
+static void add_recording(spl_rollup_t *rollup, float level, uint32_t day,
+		uint32_t hour, uint32_t hours) {
+	state.spl = level;
+	SPL_update_rollup(&state, rollup, day * SPL_SECONDS_IN_DAY + hour * 3600,
+			hours * 3600);
+}
+
+/* The recordings are split between the periods of the day and at
+ * midnight, which writes the line of the day. Lden and Ldn put the hour
+ * from 22:00 in the evening and in the night, and read 0 when a period
+ * has no recordings. */
+static void test_rollup(void) {
+
+	uint32_t day = 19000;
+
+	float Ld = 65.0f;
+	float Le = 60.0f;
+	float Llate = 55.0f;
+	float Ln = 50.0f;
+
+	spl_rollup_t rollup;
+
+	remove(ROLLUP_FILE);
+
+	SPL_reset_rollup(&rollup, day);
+
+	add_recording(&rollup, Ln, day, 0, 7);
+	add_recording(&rollup, Ld, day, 7, 12);
+	add_recording(&rollup, Le, day, 19, 3);
+	add_recording(&rollup, Llate, day, 22, 1);
+
+	CHECK(rollup.duration[SPL_ROLLUP_NIGHT] == 7 * 3600
+			&& rollup.duration[SPL_ROLLUP_DAY] == 12 * 3600
+			&& rollup.duration[SPL_ROLLUP_EVENING] == 3 * 3600
+			&& rollup.duration[SPL_ROLLUP_LATE_EVENING] == 3600,
+			"periods of %.0f, %.0f, %.0f and %.0f s",
+			rollup.duration[SPL_ROLLUP_DAY],
+			rollup.duration[SPL_ROLLUP_EVENING],
+			rollup.duration[SPL_ROLLUP_LATE_EVENING],
+			rollup.duration[SPL_ROLLUP_NIGHT]);
+
+	char line[LOG_LINE_LENGTH];
+
+	CHECK(!read_last_line(ROLLUP_FILE, line), "day written before midnight");
+
+	/* From 23:00 to 07:00 of the next day */
+	add_recording(&rollup, Ln, day, 23, 8);
+
+	CHECK(rollup.day == day + 1
+			&& rollup.duration[SPL_ROLLUP_NIGHT] == 7 * 3600
+			&& rollup.duration[SPL_ROLLUP_DAY] == 0.0f,
+			"next day %u with %.0f s of night", (unsigned int) rollup.day,
+			rollup.duration[SPL_ROLLUP_NIGHT]);
+
+	double d = pow(10.0, Ld / 10.0);
+	double e = (3.0 * pow(10.0, Le / 10.0) + pow(10.0, Llate / 10.0)) / 4.0;
+	double n = pow(10.0, Ln / 10.0);
+	double dnDay = (12.0 * d + 3.0 * pow(10.0, Le / 10.0)) / 15.0;
+	double dnNight = (pow(10.0, Llate / 10.0) + 8.0 * n) / 9.0;
+
+	double expected[] = { 10.0 * log10((12.0 * d + 4.0 * sqrt(10.0) * e
+			+ 8.0 * 10.0 * n) / 24.0), 10.0 * log10((15.0 * dnDay + 9.0
+			* 10.0 * dnNight) / 24.0), Ld, 10.0 * log10(e), Ln, 12.0, 4.0,
+			8.0 };
+
+	float values[8] = { 0.0f };
+	int date[3] = { 0 };
+
+	bool found = read_last_line(ROLLUP_FILE, line);
+
+	int fields = sscanf(line, "%d/%d/%d: %f %f %f %f %f %f %f %f", date,
+			date + 1, date + 2, values, values + 1, values + 2, values + 3,
+			values + 4, values + 5, values + 6, values + 7);
+
+	time_t rawtime = (time_t) day * SPL_SECONDS_IN_DAY;
+
+	struct tm *time = gmtime(&rawtime);
+
+	CHECK(found && fields == 11 && date[0] == time->tm_mday
+			&& date[1] == time->tm_mon + 1 && date[2] == time->tm_year + 1900,
+			"line of the day: %s", found ? line : "none");
+
+	for (uint32_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i += 1) {
+		CHECK(fabs(values[i] - expected[i]) < 0.01,
+				"field %u of the day: %.4f, %.4f expected", (unsigned int) i,
+				values[i], expected[i]);
+	}
+
+	/* A day with only its night, written by a recording two days later */
+	add_recording(&rollup, Ld, day + 2, 12, 1);
+
+	found = read_last_line(ROLLUP_FILE, line);
+
+	fields = sscanf(line, "%d/%d/%d: %f %f %f %f %f", date, date + 1,
+			date + 2, values, values + 1, values + 2, values + 3, values + 4);
+
+	CHECK(found && fields == 8 && values[0] == 0.0f && values[1] == 0.0f
+			&& values[2] == 0.0f && fabsf(values[4] - Ln) < 0.01f,
+			"line of a day with only its night: %s", found ? line : "none");
+
+	CHECK(rollup.day == day + 2 && rollup.duration[SPL_ROLLUP_DAY] == 3600,
+			"day %u with %.0f s of day", (unsigned int) rollup.day,
+			rollup.duration[SPL_ROLLUP_DAY]);
+
+	remove(ROLLUP_FILE);
+}
+
+/* Read LEX,8h, the dose, the projected dose and the hours of the last
+ * line of the exposure file */
+static bool read_exposure(float *values) {
+
+	char line[LOG_LINE_LENGTH];
+
+	int fields[6];
+
+	return read_last_line(EXPOSURE_FILE, line)
+			&& sscanf(line, "%d/%d/%d %d:%d:%d: %f %f %f %f", fields,
+					fields + 1, fields + 2, fields + 3, fields + 4, fields + 5,
+					values, values + 1, values + 2, values + 3) == 10;
+}
+
+/* The dose of a recording is the time of its intervals weighted by 2 to
+ * the power of the level above the criterion over the exchange rate, at
+ * rates with periods of different lengths too. The exposure of a shift
+ * adds the energy, the dose and the hours of its recordings, and starts
+ * again with the next shift. */
+static void test_exposure(void) {
+
+	static const float rates[] = { 48000.0f, 62500.0f };
+
+	static const float levels[] = { SPL_DOSE_CRITERION_LEVEL
+			- 2.0f * SPL_DOSE_EXCHANGE_RATE, SPL_DOSE_CRITERION_LEVEL
+			- 4.0f * SPL_DOSE_EXCHANGE_RATE };
+
+	for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r += 1) {
+
+		float fs = rates[r];
+
+		for (uint32_t k = 0; k < sizeof(levels) / sizeof(levels[0]); k += 1) {
+
+			test_signal_t signal;
+
+			start(fs);
+
+			TEST_init_signal(&signal, 1000.0, tone_amplitude(levels[k]), 0.0,
+					0.0);
+
+			process(&signal, fs, 10.0f);
+
+			/* The histogram starts after the settling of the detectors */
+			double expected = (10.0 - SPL_DETECTOR_SETTLING_TIME)
+					* exp2((levels[k] - SPL_DOSE_CRITERION_LEVEL)
+							/ SPL_DOSE_EXCHANGE_RATE);
+
+			CHECK(fabs(state.doseSum / expected - 1.0) < 0.01,
+					"%.0f Hz, %.1f dB: dose of %.4f s, %.4f s expected", fs,
+					levels[k], state.doseSum, expected);
+		}
+	}
+
+	remove(EXPOSURE_FILE);
+
+	uint32_t localTime = 19000 * SPL_SECONDS_IN_DAY + SPL_SHIFT_START + 3600;
+
+	spl_exposure_t exposure;
+
+	SPL_reset_exposure(&exposure, 0);
+
+	/* An hour at the criterion level */
+	state.spl = SPL_DOSE_CRITERION_LEVEL;
+	state.doseSum = 3600.0f;
+
+	float hour = 100.0f * 3600.0f / SPL_DOSE_REFERENCE_DURATION;
+
+	float LEX = SPL_DOSE_CRITERION_LEVEL
+			+ 10.0f * log10f(3600.0f / SPL_DOSE_REFERENCE_DURATION);
+
+	float expected[][4] = { { LEX, hour, 100.0f, 1.0f }, { LEX
+			+ 10.0f * log10f(2.0f), 2.0f * hour, 100.0f, 2.0f }, { LEX, hour,
+			100.0f, 1.0f } };
+
+	uint32_t times[] = { localTime, localTime + 3600,
+			localTime + SPL_SECONDS_IN_DAY };
+
+	for (uint32_t i = 0; i < sizeof(times) / sizeof(times[0]); i += 1) {
+
+		SPL_update_exposure(&state, &exposure, 1234567890, times[i], 3600);
+
+		float values[4] = { 0.0f };
+
+		bool found = read_exposure(values);
+
+		CHECK(found, "recording %u: no exposure line", (unsigned int) i);
+
+		for (uint32_t j = 0; j < 4; j += 1) {
+			CHECK(fabsf(values[j] - expected[i][j]) < 0.001f,
+					"recording %u, field %u: %.4f, %.4f expected",
+					(unsigned int) i, (unsigned int) j, values[j],
+					expected[i][j]);
+		}
+	}
+
+	remove(EXPOSURE_FILE);
+}
+
+/* The calibration file sets the offsets of the gains it lists, in
+ * hundredths of dB, and moves the others by the mean correction of the
+ * listed gains. Gains out of range and the text after the last valid line
+ * are ignored, and the offsets are written back in the same format. This
+ * changes the offsets for the rest of the program, so it runs last. */
+static void test_calibration_file(void) {
+
+	remove(CALIBRATION_FILE);
+
+	CHECK(!SPL_read_calibration(CALIBRATION_FILE),
+			"missing calibration file read");
+
+	FILE *file = fopen(CALIBRATION_FILE, "w");
+
+	if (file != NULL) {
+		fputs("1 7000\n3 6500\n9 5000\nend\n2 6000\n", file);
+		fclose(file);
+	}
+
+	CHECK(SPL_read_calibration(CALIBRATION_FILE),
+			"could not read %s", CALIBRATION_FILE);
+
+	float correction = ((70.0f - CALdBA_low_med) + (65.0f - CALdBA_med_high))
+			/ 2.0f;
+
+	float expected[SPL_NUMBER_OF_GAINS] = { CALdBA_low + correction, 70.0f,
+			CALdBA_med + correction, 65.0f, CALdBA_high + correction };
+
+	for (uint32_t i = 0; i < SPL_NUMBER_OF_GAINS; i += 1) {
+		SPL_find_calibration_offset(&state, i);
+		CHECK(fabsf(state.cal_offset - expected[i]) < 0.001f,
+				"gain %u: offset %.3f dB, %.3f dB expected", (unsigned int) i,
+				state.cal_offset, expected[i]);
+	}
+
+	CHECK(SPL_write_calibration(CALIBRATION_FILE),
+			"could not write %s", CALIBRATION_FILE);
+
+	char text[SPL_CALIBRATION_FILE_LENGTH + 1] = { 0 };
+
+	file = fopen(CALIBRATION_FILE, "r");
+
+	if (file != NULL) {
+		size_t length = fread(text, 1, SPL_CALIBRATION_FILE_LENGTH, file);
+		text[length] = 0;
+		fclose(file);
+	}
+
+	CHECK(strcmp(text, "1 7000\n3 6500\n") == 0,
+			"calibration file written as \"%s\"", text);
+
+	remove(CALIBRATION_FILE);
+}
+
+int main(void) {
+
+	test_compensation();
+	test_calibration_reference();
+	test_weighting_tolerances();
+	test_offset();
+	test_loud_low_frequency();
+	test_long_integration();
+	test_next_gain();
+	test_time_weighting();
+	test_intervals();
+	test_statistical_levels();
+	test_peaks();
+	test_events();
+	test_rollup();
+	test_exposure();
+	test_calibration_file();
+
+#if SPL_TRUE_PEAK
+	return TEST_report("test_spl (delta engine, true peak)");
+#elif SPL_ENGINE == SPL_ENGINE_Q31
+	return TEST_report("test_spl (Q31 engine)");
+#elif SPL_ENGINE == SPL_ENGINE_FLOAT_DELTA
+	return TEST_report("test_spl (delta engine)");
+#else
+	return TEST_report("test_spl (float engine)");
+#endif
+}